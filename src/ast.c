@@ -1,6 +1,65 @@
 #include "ast.h"
 
-arena ast_arena;
+#undef MEM_TAG
+#define MEM_TAG MEM_AST
+
+_Thread_local arena ast_arena = {.tag = MEM_AST};
+
+const char* typespec_type_names[] =
+{
+    [TYPESPEC_NONE] = "none",
+    [TYPESPEC_NAME] = "name",
+    [TYPESPEC_FUNC] = "func",
+    [TYPESPEC_ARRAY] = "array",
+    [TYPESPEC_PTR] = "ptr",
+    [TYPESPEC_CONST] = "const",
+};
+
+const char* decl_type_names[] =
+{
+    [DECL_NONE] = "none",
+    [DECL_ENUM] = "enum",
+    [DECL_ERR] = "err",
+    [DECL_STRUCT] = "struct",
+    [DECL_UNION] = "union",
+    [DECL_VAR] = "let",
+    [DECL_CONST] = "const",
+    [DECL_FUNC] = "fn",
+};
+
+const char* expr_type_names[] =
+{
+    [EXPR_NONE] = "none",
+    [EXPR_INT] = "int",
+    [EXPR_FLOAT] = "float",
+    [EXPR_STR] = "str",
+    [EXPR_NAME] = "name",
+    [EXPR_CAST] = "cast",
+    [EXPR_CALL] = "call",
+    [EXPR_INDEX] = "index",
+    [EXPR_FIELD] = "field",
+    [EXPR_COMPOUND] = "compound",
+    [EXPR_UNARY] = "unary",
+    [EXPR_BINARY] = "binary",
+    [EXPR_TERNARY] = "ternary",
+};
+
+const char* stmt_type_names[] =
+{
+    [STMT_NONE] = "none",
+    [STMT_DECL] = "decl",
+    [STMT_RETURN] = "return",
+    [STMT_BLOCK] = "block",
+    [STMT_IF] = "if",
+    [STMT_FOR] = "for",
+    [STMT_WHILE] = "while",
+    [STMT_SWITCH] = "switch",
+    [STMT_BREAK] = "break",
+    [STMT_CONTINUE] = "continue",
+    [STMT_INIT] = "init",
+    [STMT_ASSIGN] = "assign",
+    [STMT_EXPR] = "expr",
+};
 
 void* ast_alloc(size_t size)
 {
@@ -20,88 +79,416 @@ void* ast_dup(const void* src, size_t size)
     return ptr;
 }
 
-typespec* typespec_new(typespec_type type)
+// Node handles. Every thread's AST arena blocks, and every mapped cache file,
+// are registered in one table of 512KB slices. The high 16 bits of a handle
+// pick a slice, the low 16 bits an 8-byte aligned offset in it. A block gets
+// consecutive slices, so a node's handle is its block's handle plus its offset
+// in the block over 8. Slices are never released: arenas keep their blocks
+// through resets, and cache mappings are never unmapped.
+#define AST_SLICE_SHIFT 19
+#define AST_MAX_SLICES (1 << 16)
+
+static struct
+{
+    const char* slices[AST_MAX_SLICES];
+    u32 num_slices;
+    pthread_mutex_t lock;
+} ast_slices = {.num_slices = 1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Handle of the start of each of this thread's AST arena blocks, by index.
+static _Thread_local u32* ast_block_refs;
+static _Thread_local size_t ast_last_block;
+
+// Makes nodes in base..base+size addressable and returns the handle of base.
+u32 ast_register(const char* base, size_t size)
+{
+    assert(base == ALIGN_DOWN_PTR(base, ARENA_ALIGNMENT) && size);
+    size_t num = ((size - 1) >> AST_SLICE_SHIFT) + 1;
+    pthread_mutex_lock(&ast_slices.lock);
+    u32 first = ast_slices.num_slices;
+    assert(num <= AST_MAX_SLICES - first);
+    for(size_t i = 0; i < num; i++)
+    {
+        ast_slices.slices[first + i] = base + (i << AST_SLICE_SHIFT);
+    }
+    ast_slices.num_slices += (u32)num;
+    pthread_mutex_unlock(&ast_slices.lock);
+    return first << 16;
+}
+
+// Handle of a node in this thread's AST arena.
+u32 ast_ref(const void* node)
+{
+    if(!node)
+    {
+        return 0;
+    }
+    arena_block* blocks = ast_arena.blocks;
+    while(buf_len(ast_block_refs) < buf_len(blocks))
+    {
+        arena_block* block = &blocks[buf_len(ast_block_refs)];
+        buf_push(ast_block_refs, ast_register(block->base, block->size));
+    }
+    // Children are nearly always in the block their parent is going into.
+    const char* p = node;
+    size_t i = ast_last_block;
+    if(i >= buf_len(blocks) || p < blocks[i].base || p >= blocks[i].base + blocks[i].size)
+    {
+        for(i = 0; i < buf_len(blocks); i++)
+        {
+            if(p >= blocks[i].base && p < blocks[i].base + blocks[i].size)
+            {
+                break;
+            }
+        }
+        assert(i < buf_len(blocks));
+        ast_last_block = i;
+    }
+    return ast_block_refs[i] + (u32)((p - blocks[i].base) >> 3);
+}
+
+static const void* ast_at(u32 ref)
+{
+    return ref ? ast_slices.slices[ref >> 16] + ((size_t)(ref & 0xFFFF) << 3) : NULL;
+}
+
+expr* expr_at(expr_ref ref)
+{
+    return (expr*)ast_at(ref);
+}
+
+stmt* stmt_at(stmt_ref ref)
+{
+    return (stmt*)ast_at(ref);
+}
+
+// Size of a node whose kind only uses the given union member.
+#define NODE_SIZE(type, field) (offsetof(type, field) + sizeof(((type*)0)->field))
+
+const size_t typespec_sizes[] =
+{
+    [TYPESPEC_NONE] = NODE_SIZE(typespec, pos),
+    [TYPESPEC_NAME] = NODE_SIZE(typespec, sym),
+    [TYPESPEC_FUNC] = NODE_SIZE(typespec, func),
+    [TYPESPEC_ARRAY] = NODE_SIZE(typespec, array),
+    [TYPESPEC_PTR] = NODE_SIZE(typespec, ptr),
+    [TYPESPEC_CONST] = NODE_SIZE(typespec, pos),
+};
+
+const size_t decl_sizes[] =
+{
+    [DECL_NONE] = NODE_SIZE(decl, sym),
+    [DECL_ENUM] = NODE_SIZE(decl, enum_decl),
+    [DECL_ERR] = NODE_SIZE(decl, enum_decl),
+    [DECL_STRUCT] = NODE_SIZE(decl, aggregate_decl),
+    [DECL_UNION] = NODE_SIZE(decl, aggregate_decl),
+    [DECL_VAR] = NODE_SIZE(decl, var_decl),
+    [DECL_CONST] = NODE_SIZE(decl, const_decl),
+    [DECL_FUNC] = NODE_SIZE(decl, func_decl),
+};
+
+const size_t expr_sizes[] =
+{
+    [EXPR_NONE] = NODE_SIZE(expr, pos),
+    [EXPR_INT] = NODE_SIZE(expr, int_val),
+    [EXPR_FLOAT] = NODE_SIZE(expr, float_val),
+    [EXPR_STR] = NODE_SIZE(expr, str_val),
+    [EXPR_NAME] = NODE_SIZE(expr, sym),
+    [EXPR_CAST] = NODE_SIZE(expr, cast),
+    [EXPR_CALL] = NODE_SIZE(expr, call),
+    [EXPR_INDEX] = NODE_SIZE(expr, index),
+    [EXPR_FIELD] = NODE_SIZE(expr, field),
+    [EXPR_COMPOUND] = NODE_SIZE(expr, compound),
+    [EXPR_UNARY] = NODE_SIZE(expr, unary),
+    [EXPR_BINARY] = NODE_SIZE(expr, binary),
+    [EXPR_TERNARY] = NODE_SIZE(expr, ternary),
+};
+
+const size_t stmt_sizes[] =
+{
+    [STMT_NONE] = NODE_SIZE(stmt, pos),
+    [STMT_DECL] = NODE_SIZE(stmt, decl),
+    [STMT_RETURN] = NODE_SIZE(stmt, return_stmt),
+    [STMT_BLOCK] = NODE_SIZE(stmt, block),
+    [STMT_IF] = NODE_SIZE(stmt, if_stmt),
+    [STMT_FOR] = NODE_SIZE(stmt, for_stmt),
+    [STMT_WHILE] = NODE_SIZE(stmt, while_stmt),
+    [STMT_SWITCH] = NODE_SIZE(stmt, switch_stmt),
+    [STMT_BREAK] = NODE_SIZE(stmt, pos),
+    [STMT_CONTINUE] = NODE_SIZE(stmt, pos),
+    [STMT_INIT] = NODE_SIZE(stmt, init),
+    [STMT_ASSIGN] = NODE_SIZE(stmt, assign),
+    [STMT_EXPR] = NODE_SIZE(stmt, expr),
+};
+
+typespec* typespec_new(u32 pos, typespec_type type)
 {
-    typespec* t = ast_alloc(sizeof(typespec));
+    typespec* t = ast_alloc(typespec_sizes[type]);
     t->type = type;
+    t->pos = pos;
     return t;
 }
 
-typespec* typespec_name(const char* name)
+// Typespecs are hash-consed: structurally identical typespecs share a single
+// canonical node, so two typespecs name the same type exactly when they're the
+// same pointer. Array typespecs take part when their size is missing or an
+// integer literal. Canonical nodes are shared by every thread and live in the
+// table's own arena; their pos is wherever the type was first written.
+typedef struct
 {
-    typespec* t = typespec_new(TYPESPEC_NAME);
-    t->name = name;
-    return t;
+    u64 hash;
+    typespec* type;
+} typespec_entry;
+
+typedef struct
+{
+    typespec_entry* entries;
+    size_t len;
+    size_t cap;
+    arena arena;
+    pthread_mutex_t lock;
+} typespec_table;
+
+static typespec_table typespecs = {.arena.tag = MEM_AST, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Same scheme as the interner's cache: most lookups are for a type the thread
+// has built before and never take the lock.
+#define TYPESPEC_CACHE_SIZE 256
+
+static _Thread_local typespec* typespec_cache[TYPESPEC_CACHE_SIZE];
+
+#define TYPESPEC_MIN_CAP 256
+
+static u64 typespec_hash(const typespec* t)
+{
+    u64 h = hash_mix(t->type);
+    switch(t->type)
+    {
+    case TYPESPEC_NAME:
+        h = hash_mix(h ^ (uintptr_t)t->name);
+        break;
+    case TYPESPEC_FUNC:
+        h = hash_mix(h ^ t->func.num_args ^ (u64)t->func.num_rets << 32);
+        for(size_t i = 0; i < t->func.num_args; i++)
+        {
+            h = hash_mix(h ^ (uintptr_t)t->func.args[i]);
+        }
+        for(size_t i = 0; i < t->func.num_rets; i++)
+        {
+            h = hash_mix(h ^ (uintptr_t)t->func.rets[i]);
+        }
+        break;
+    case TYPESPEC_ARRAY:
+        h = hash_mix(h ^ (uintptr_t)t->array.elem);
+        h = hash_mix(h ^ (t->array.size ? t->array.size->int_val : ~0ull));
+        break;
+    case TYPESPEC_PTR:
+        h = hash_mix(h ^ (uintptr_t)t->ptr.elem);
+        break;
+    default:
+        break;
+    }
+    return h;
 }
 
-typespec* typespec_func(typespec** args, size_t num_args, typespec** rets, size_t num_rets)
+static bool typespec_equal(const typespec* a, const typespec* b)
 {
-    typespec* t = typespec_new(TYPESPEC_FUNC);
-    t->func.args = args;
-    t->func.num_args = num_args;
-    t->func.rets = rets;
-    t->func.num_rets = num_rets;
-    return t;
+    if(a->type != b->type)
+    {
+        return false;
+    }
+    switch(a->type)
+    {
+    case TYPESPEC_NAME:
+        return a->name == b->name;
+    case TYPESPEC_FUNC:
+        return a->func.num_args == b->func.num_args && a->func.num_rets == b->func.num_rets &&
+               (!a->func.num_args || memcmp(a->func.args, b->func.args, a->func.num_args*sizeof(typespec*)) == 0) &&
+               (!a->func.num_rets || memcmp(a->func.rets, b->func.rets, a->func.num_rets*sizeof(typespec*)) == 0);
+    case TYPESPEC_ARRAY:
+        if(a->array.elem != b->array.elem || !a->array.size != !b->array.size)
+        {
+            return false;
+        }
+        return !a->array.size || a->array.size->int_val == b->array.size->int_val;
+    case TYPESPEC_PTR:
+        return a->ptr.elem == b->ptr.elem;
+    default:
+        return false;
+    }
 }
 
-typespec* typespec_array(typespec* elem, expr* size)
+static void* typespec_table_dup(const void* src, size_t size)
 {
-    typespec* t = typespec_new(TYPESPEC_ARRAY);
-    t->array.elem = elem;
-    t->array.size = size;
-    return t;
+    if(size == 0)
+    {
+        return NULL;
+    }
+    void* ptr = arena_alloc(&typespecs.arena, size);
+    memcpy(ptr, src, size);
+    return ptr;
 }
 
-typespec* typespec_ptr(typespec* elem)
+static void typespec_grow()
 {
-    typespec* t = typespec_new(TYPESPEC_PTR);
-    t->ptr.elem = elem;
+    size_t new_cap = CLAMP_MIN(2*typespecs.cap, TYPESPEC_MIN_CAP);
+    typespec_entry* new_entries = calloc(new_cap, sizeof(typespec_entry));
+    mem_track_alloc(MEM_AST, new_cap*sizeof(typespec_entry));
+    for(size_t i = 0; i < typespecs.cap; i++)
+    {
+        typespec_entry* it = &typespecs.entries[i];
+        if(!it->type)
+        {
+            continue;
+        }
+        size_t j = it->hash & (new_cap - 1);
+        while(new_entries[j].type)
+        {
+            j = (j + 1) & (new_cap - 1);
+        }
+        new_entries[j] = *it;
+    }
+    free(typespecs.entries);
+    mem_track_free(MEM_AST, typespecs.cap*sizeof(typespec_entry));
+    typespecs.entries = new_entries;
+    typespecs.cap = new_cap;
+}
+
+// Copies key into the table, along with the arrays and size it points to,
+// unless an equal typespec is already there.
+static typespec* typespec_locked(const typespec* key, u64 hash)
+{
+    if(2*typespecs.len >= typespecs.cap)
+    {
+        typespec_grow();
+    }
+    size_t i = hash & (typespecs.cap - 1);
+    for(;;)
+    {
+        typespec_entry* it = &typespecs.entries[i];
+        if(!it->type)
+        {
+            typespec* t = typespec_table_dup(key, typespec_sizes[key->type]);
+            if(t->type == TYPESPEC_FUNC)
+            {
+                t->func.args = typespec_table_dup(key->func.args, key->func.num_args*sizeof(typespec*));
+                t->func.rets = typespec_table_dup(key->func.rets, key->func.num_rets*sizeof(typespec*));
+            }
+            else if(t->type == TYPESPEC_ARRAY && t->array.size)
+            {
+                t->array.size = typespec_table_dup(key->array.size, expr_sizes[EXPR_INT]);
+            }
+            *it = (typespec_entry){hash, t};
+            typespecs.len++;
+            return t;
+        }
+        if(it->hash == hash && typespec_equal(it->type, key))
+        {
+            return it->type;
+        }
+        i = (i + 1) & (typespecs.cap - 1);
+    }
+}
+
+static typespec* typespec_canonical(const typespec* key)
+{
+    u64 hash = typespec_hash(key);
+    typespec** cached = &typespec_cache[hash & (TYPESPEC_CACHE_SIZE - 1)];
+    if(*cached && typespec_equal(*cached, key))
+    {
+        return *cached;
+    }
+    pthread_mutex_lock(&typespecs.lock);
+    typespec* t = typespec_locked(key, hash);
+    pthread_mutex_unlock(&typespecs.lock);
+    *cached = t;
     return t;
 }
 
-decl* decl_new(decl_type type, const char* name)
+typespec* typespec_name(u32 pos, const char* name)
+{
+    typespec key = {TYPESPEC_NAME, pos};
+    key.name = name;
+    return typespec_canonical(&key);
+}
+
+typespec* typespec_func(u32 pos, typespec** args, size_t num_args, typespec** rets, size_t num_rets)
 {
-    decl* d = ast_alloc(sizeof(decl));
+    typespec key = {TYPESPEC_FUNC, pos};
+    key.func.args = args;
+    key.func.num_args = num_args;
+    key.func.rets = rets;
+    key.func.num_rets = num_rets;
+    return typespec_canonical(&key);
+}
+
+typespec* typespec_array(u32 pos, typespec* elem, expr* size)
+{
+    if(size && size->type != EXPR_INT)
+    {
+        typespec* t = typespec_new(pos, TYPESPEC_ARRAY);
+        t->array.elem = elem;
+        t->array.size = size;
+        return t;
+    }
+    typespec key = {TYPESPEC_ARRAY, pos};
+    key.array.elem = elem;
+    key.array.size = size;
+    return typespec_canonical(&key);
+}
+
+typespec* typespec_ptr(u32 pos, typespec* elem)
+{
+    typespec key = {TYPESPEC_PTR, pos};
+    key.ptr.elem = elem;
+    return typespec_canonical(&key);
+}
+
+decl* decl_new(u32 pos, decl_type type, const char* name)
+{
+    decl* d = ast_alloc(decl_sizes[type]);
     d->type = type;
+    d->pos = pos;
     d->name = name;
     return d;
 }
 
-decl* decl_enum(const char* name, enum_item* items, size_t num_items)
+decl* decl_enum(u32 pos, const char* name, enum_item* items, size_t num_items)
 {
-    decl* d = decl_new(DECL_ENUM, name);
+    decl* d = decl_new(pos, DECL_ENUM, name);
     d->enum_decl.items = items;
     d->enum_decl.num_items = num_items;
     return d;
 }
 
-decl* decl_aggregate(decl_type type, const char* name, aggregate_item* items, size_t num_items)
+decl* decl_aggregate(u32 pos, decl_type type, const char* name, aggregate_item* items, size_t num_items)
 {
     assert(type == DECL_STRUCT || type == DECL_UNION);
-    decl* d = decl_new(type, name);
+    decl* d = decl_new(pos, type, name);
     d->aggregate_decl.items = items;
     d->aggregate_decl.num_items = num_items;
     return d;
 }
 
-decl* decl_var(const char* name, typespec* type, expr* expr)
+decl* decl_var(u32 pos, const char* name, typespec* type, expr* expr)
 {
-    decl* d = decl_new(DECL_VAR, name);
+    decl* d = decl_new(pos, DECL_VAR, name);
     d->var_decl.type = type;
     d->var_decl.expr = expr;
     return d;
 }
 
-decl* decl_const(const char* name, expr* expr)
+decl* decl_const(u32 pos, const char* name, typespec* type, expr* expr)
 {
-    decl* d = decl_new(DECL_CONST, name);
+    decl* d = decl_new(pos, DECL_CONST, name);
+    d->const_decl.type = type;
     d->const_decl.expr = expr;
     return d;
 }
 
-decl* decl_func(const char* name, func_item* param_list, size_t num_params, typespec** return_type, size_t num_return, s_block block)
+decl* decl_func(u32 pos, const char* name, func_item* param_list, size_t num_params, typespec** return_type, size_t num_return, s_block block)
 {
-    decl* d = decl_new(DECL_FUNC, name);
+    decl* d = decl_new(pos, DECL_FUNC, name);
     d->func_decl.param_list = param_list;
     d->func_decl.num_params = num_params;
     d->func_decl.return_type = return_type;
@@ -110,138 +497,143 @@ decl* decl_func(const char* name, func_item* param_list, size_t num_params, type
     return d;
 }
 
-expr* expr_new(expr_type type)
+expr* expr_new(u32 pos, expr_type type)
 {
-    expr* e = ast_alloc(sizeof(expr));
+    expr* e = ast_alloc(expr_sizes[type]);
     e->type = type;
+    e->pos = pos;
     return e;
 }
 
-expr* expr_int(u64 int_val)
+expr* expr_int(u32 pos, u64 int_val)
 {
-    expr* e = expr_new(EXPR_INT);
+    expr* e = expr_new(pos, EXPR_INT);
     e->int_val = int_val;
     return e;
 }
 
-expr* expr_float(f64 float_val)
+expr* expr_float(u32 pos, f64 float_val)
 {
-    expr* e = expr_new(EXPR_FLOAT);
+    expr* e = expr_new(pos, EXPR_FLOAT);
     e->float_val = float_val;
     return e;
 }
 
-expr* expr_str(const char* str)
+expr* expr_str(u32 pos, const char* str)
 {
-    expr* e = expr_new(EXPR_STR);
+    expr* e = expr_new(pos, EXPR_STR);
     e->str_val = str;
     return e;
 }
 
-expr* expr_name(const char* name)
+expr* expr_name(u32 pos, const char* name)
 {
-    expr* e = expr_new(EXPR_NAME);
+    expr* e = expr_new(pos, EXPR_NAME);
     e->name = name;
     return e;
 }
 
-expr* expr_cast(typespec* type, expr* exp)
+expr* expr_cast(u32 pos, typespec* type, expr* exp)
 {
-    expr* e = expr_new(EXPR_CAST);
-    e->cast.expr = exp;
+    expr* e = expr_new(pos, EXPR_CAST);
+    e->cast.type = type;
+    e->cast.expr = ast_ref(exp);
+    return e;
 }
 
-expr* expr_call(expr* exp, expr** args, size_t num_args)
+expr* expr_call(u32 pos, expr* exp, expr_ref* args, size_t num_args)
 {
-    expr* e = expr_new(EXPR_CALL);
-    e->call.expr = exp;
+    expr* e = expr_new(pos, EXPR_CALL);
+    e->call.expr = ast_ref(exp);
     e->call.args = args;
     e->call.num_args = num_args;
     return e;
 }
 
-expr* expr_index(expr* exp, expr* index)
+expr* expr_index(u32 pos, expr* exp, expr* index)
 {
-    expr* e = expr_new(EXPR_INDEX);
-    e->index.expr = exp;
-    e->index.index = index;
+    expr* e = expr_new(pos, EXPR_INDEX);
+    e->index.expr = ast_ref(exp);
+    e->index.index = ast_ref(index);
     return e;
 }
 
-expr* expr_field(expr* exp, const char* name)
+expr* expr_field(u32 pos, expr* exp, const char* name)
 {
-    expr* e = expr_new(EXPR_FIELD);
-    e->field.expr = exp;
+    expr* e = expr_new(pos, EXPR_FIELD);
+    e->field.expr = ast_ref(exp);
     e->field.name = name;
+    return e;
 }
 
-expr* expr_compound(typespec* type, expr** args, size_t num_args)
+expr* expr_compound(u32 pos, typespec* type, expr_ref* args, size_t num_args)
 {
-    expr* e = expr_new(EXPR_COMPOUND);
+    expr* e = expr_new(pos, EXPR_COMPOUND);
     e->compound.type = type;
     e->compound.args = args;
     e->compound.num_args = num_args;
     return e;
 }
 
-expr* expr_unary(token_type op, expr* exp)
+expr* expr_unary(u32 pos, token_type op, expr* exp)
 {
-    expr* e = expr_new(EXPR_UNARY);
-    e->unary.op = op;
-    e->unary.expr = exp;
+    expr* e = expr_new(pos, EXPR_UNARY);
+    e->op = (u8)op;
+    e->unary.expr = ast_ref(exp);
     return e;
 }
 
-expr* expr_binary(token_type op, expr* left, expr* right)
+expr* expr_binary(u32 pos, token_type op, expr* left, expr* right)
 {
-    expr* e = expr_new(EXPR_BINARY);
-    e->binary.op = op;
-    e->binary.left = left;
-    e->binary.right = right;
+    expr* e = expr_new(pos, EXPR_BINARY);
+    e->op = (u8)op;
+    e->binary.left = ast_ref(left);
+    e->binary.right = ast_ref(right);
     return e;
 }
 
-expr* expr_ternary(expr* cond, expr* then_expr, expr* else_expr)
+expr* expr_ternary(u32 pos, expr* cond, expr* then_expr, expr* else_expr)
 {
-    expr* e = expr_new(EXPR_TERNARY);
-    e->ternary.cond = cond;
-    e->ternary.then_expr = then_expr;
-    e->ternary.else_expr = else_expr;
+    expr* e = expr_new(pos, EXPR_TERNARY);
+    e->ternary.cond = ast_ref(cond);
+    e->ternary.then_expr = ast_ref(then_expr);
+    e->ternary.else_expr = ast_ref(else_expr);
     return e;
 }
 
-stmt* stmt_new(stmt_type type)
+stmt* stmt_new(u32 pos, stmt_type type)
 {
-    stmt* s = ast_alloc(sizeof(stmt));
+    stmt* s = ast_alloc(stmt_sizes[type]);
     s->type = type;
+    s->pos = pos;
     return s;
 }
 
-stmt* stmt_decl(decl* decl)
+stmt* stmt_decl(u32 pos, decl* decl)
 {
-    stmt* s = stmt_new(STMT_DECL);
+    stmt* s = stmt_new(pos, STMT_DECL);
     s->decl = decl;
     return s;
 }
 
-stmt* stmt_return(expr* expr)
+stmt* stmt_return(u32 pos, expr* expr)
 {
-    stmt* s = stmt_new(STMT_RETURN);
-    s->return_stmt.expr = expr;
+    stmt* s = stmt_new(pos, STMT_RETURN);
+    s->return_stmt.expr = ast_ref(expr);
     return s;
 }
 
-stmt* stmt_block(s_block block)
+stmt* stmt_block(u32 pos, s_block block)
 {
-    stmt* s = stmt_new(STMT_BLOCK);
+    stmt* s = stmt_new(pos, STMT_BLOCK);
     s->block = block;
     return s;
 }
 
-stmt* stmt_if(expr* cond, s_block then_block, else_if* elseifs, size_t num_elseifs, s_block else_block)
+stmt* stmt_if(u32 pos, expr* cond, s_block then_block, else_if* elseifs, size_t num_elseifs, s_block else_block)
 {
-    stmt* s = stmt_new(STMT_IF);
-    s->if_stmt.cond = cond;
+    stmt* s = stmt_new(pos, STMT_IF);
+    s->if_stmt.cond = ast_ref(cond);
     s->if_stmt.then_block = then_block;
     s->if_stmt.elseifs = elseifs;
     s->if_stmt.num_elseifs = num_elseifs;
@@ -249,63 +641,315 @@ stmt* stmt_if(expr* cond, s_block then_block, else_if* elseifs, size_t num_elsei
     return s;
 }
 
-stmt* stmt_for(stmt* init, expr* cond, stmt* next, s_block block)
+stmt* stmt_for(u32 pos, stmt* init, expr* cond, stmt* next, s_block block)
 {
-    stmt* s = stmt_new(STMT_FOR);
-    s->for_stmt.init = init;
-    s->for_stmt.cond = cond;
-    s->for_stmt.next = next;
+    stmt* s = stmt_new(pos, STMT_FOR);
+    s->for_stmt.init = ast_ref(init);
+    s->for_stmt.cond = ast_ref(cond);
+    s->for_stmt.next = ast_ref(next);
     s->for_stmt.block = block;
     return s;
 }
 
-stmt* stmt_while(expr* cond, s_block block)
+stmt* stmt_while(u32 pos, expr* cond, s_block block)
 {
-    stmt* s = stmt_new(STMT_WHILE);
-    s->while_stmt.cond = cond;
+    stmt* s = stmt_new(pos, STMT_WHILE);
+    s->while_stmt.cond = ast_ref(cond);
     s->while_stmt.block = block;
     return s;
 }
 
-stmt* stmt_switch(expr* expr, switch_case* cases, size_t num_cases)
+stmt* stmt_switch(u32 pos, expr* expr, switch_case* cases, size_t num_cases)
 {
-    stmt* s = stmt_new(STMT_SWITCH);
-    s->switch_stmt.expr = expr;
+    stmt* s = stmt_new(pos, STMT_SWITCH);
+    s->switch_stmt.expr = ast_ref(expr);
     s->switch_stmt.cases = cases;
     s->switch_stmt.num_cases = num_cases;
     return s;
 }
 
-stmt* stmt_break()
+stmt* stmt_break(u32 pos)
 {
-    return stmt_new(STMT_BREAK);
+    return stmt_new(pos, STMT_BREAK);
 }
 
-stmt* stmt_continue()
+stmt* stmt_continue(u32 pos)
 {
-    return stmt_new(STMT_CONTINUE);
+    return stmt_new(pos, STMT_CONTINUE);
 }
 
-stmt* stmt_init(const char* name, expr* expr)
+stmt* stmt_init(u32 pos, const char* name, expr* expr)
 {
-    stmt* s = stmt_new(STMT_INIT);
+    stmt* s = stmt_new(pos, STMT_INIT);
     s->init.name = name;
-    s->init.expr = expr;
+    s->init.expr = ast_ref(expr);
     return s;
 }
 
-stmt* stmt_assign(token_type op, expr* left, expr* right)
+stmt* stmt_assign(u32 pos, token_type op, expr* left, expr* right)
 {
-    stmt* s = stmt_new(STMT_ASSIGN);
-    s->assign.op = op;
-    s->assign.left = left;
-    s->assign.right = right;
+    stmt* s = stmt_new(pos, STMT_ASSIGN);
+    s->op = (u8)op;
+    s->assign.left = ast_ref(left);
+    s->assign.right = ast_ref(right);
     return s;
 }
 
-stmt* stmt_expr(expr* exp)
+stmt* stmt_expr(u32 pos, expr* exp)
 {
-    stmt* s = stmt_new(STMT_EXPR);
-    s->expr = exp;
+    stmt* s = stmt_new(pos, STMT_EXPR);
+    s->expr = ast_ref(exp);
     return s;
 }
+
+// AST walker. Nodes are visited depth first in source order, with pre called
+// on the way down and post on the way up. The work stack is kept in the walker
+// and reused, so a pass can walk one declaration at a time without allocating.
+// Shared typespecs are visited every time they're referenced, and skipped
+// function bodies aren't parsed, so their block is empty.
+static void walk_push(ast_walker* w, ast_kind kind, void* node)
+{
+    if(node)
+    {
+        buf_push(w->stack, (walk_item){(u8)kind, .node = node});
+    }
+}
+
+static void walk_push_list(ast_walker* w, ast_kind kind, void* list, u32 num)
+{
+    if(num)
+    {
+        buf_push(w->stack, (walk_item){(u8)kind, false, num, .list = list});
+    }
+}
+
+static void walk_push_block(ast_walker* w, s_block block)
+{
+    walk_push_list(w, AST_STMT, block.stmt, block.num_stmts);
+}
+
+// Children are pushed last to first so they come off the stack in order.
+static void walk_push_children(ast_walker* w, ast_node node)
+{
+    switch(node.kind)
+    {
+    case AST_TYPESPEC:
+    {
+        typespec* t = node.type;
+        switch(t->type)
+        {
+        case TYPESPEC_FUNC:
+            walk_push_list(w, AST_TYPESPEC, t->func.rets, t->func.num_rets);
+            walk_push_list(w, AST_TYPESPEC, t->func.args, t->func.num_args);
+            break;
+        case TYPESPEC_ARRAY:
+            walk_push(w, AST_EXPR, t->array.size);
+            walk_push(w, AST_TYPESPEC, t->array.elem);
+            break;
+        case TYPESPEC_PTR:
+            walk_push(w, AST_TYPESPEC, t->ptr.elem);
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    case AST_DECL:
+    {
+        decl* d = node.decl;
+        switch(d->type)
+        {
+        case DECL_ENUM:
+            for(u32 i = d->enum_decl.num_items; i-- > 0;)
+            {
+                walk_push(w, AST_EXPR, d->enum_decl.items[i].init);
+            }
+            break;
+        case DECL_STRUCT:
+        case DECL_UNION:
+            for(u32 i = d->aggregate_decl.num_items; i-- > 0;)
+            {
+                walk_push(w, AST_EXPR, d->aggregate_decl.items[i].init);
+                walk_push(w, AST_TYPESPEC, d->aggregate_decl.items[i].type);
+            }
+            break;
+        case DECL_VAR:
+            walk_push(w, AST_EXPR, d->var_decl.expr);
+            walk_push(w, AST_TYPESPEC, d->var_decl.type);
+            break;
+        case DECL_CONST:
+            walk_push(w, AST_EXPR, d->const_decl.expr);
+            walk_push(w, AST_TYPESPEC, d->const_decl.type);
+            break;
+        case DECL_FUNC:
+            walk_push_block(w, d->func_decl.block);
+            walk_push_list(w, AST_TYPESPEC, d->func_decl.return_type, d->func_decl.num_return);
+            for(u32 i = d->func_decl.num_params; i-- > 0;)
+            {
+                walk_push(w, AST_TYPESPEC, d->func_decl.param_list[i].type);
+            }
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    case AST_EXPR:
+    {
+        expr* e = node.expr;
+        switch(e->type)
+        {
+        case EXPR_CAST:
+            walk_push(w, AST_EXPR, expr_at(e->cast.expr));
+            walk_push(w, AST_TYPESPEC, e->cast.type);
+            break;
+        case EXPR_CALL:
+            walk_push_list(w, AST_EXPR, e->call.args, e->call.num_args);
+            walk_push(w, AST_EXPR, expr_at(e->call.expr));
+            break;
+        case EXPR_INDEX:
+            walk_push(w, AST_EXPR, expr_at(e->index.index));
+            walk_push(w, AST_EXPR, expr_at(e->index.expr));
+            break;
+        case EXPR_FIELD:
+            walk_push(w, AST_EXPR, expr_at(e->field.expr));
+            break;
+        case EXPR_COMPOUND:
+            walk_push_list(w, AST_EXPR, e->compound.args, e->compound.num_args);
+            walk_push(w, AST_TYPESPEC, e->compound.type);
+            break;
+        case EXPR_UNARY:
+            walk_push(w, AST_EXPR, expr_at(e->unary.expr));
+            break;
+        case EXPR_BINARY:
+            walk_push(w, AST_EXPR, expr_at(e->binary.right));
+            walk_push(w, AST_EXPR, expr_at(e->binary.left));
+            break;
+        case EXPR_TERNARY:
+            walk_push(w, AST_EXPR, expr_at(e->ternary.else_expr));
+            walk_push(w, AST_EXPR, expr_at(e->ternary.then_expr));
+            walk_push(w, AST_EXPR, expr_at(e->ternary.cond));
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    case AST_STMT:
+    {
+        stmt* s = node.stmt;
+        switch(s->type)
+        {
+        case STMT_DECL:
+            walk_push(w, AST_DECL, s->decl);
+            break;
+        case STMT_RETURN:
+            walk_push(w, AST_EXPR, expr_at(s->return_stmt.expr));
+            break;
+        case STMT_BLOCK:
+            walk_push_block(w, s->block);
+            break;
+        case STMT_IF:
+            walk_push_block(w, s->if_stmt.else_block);
+            for(u32 i = s->if_stmt.num_elseifs; i-- > 0;)
+            {
+                walk_push_block(w, s->if_stmt.elseifs[i].block);
+                walk_push(w, AST_EXPR, expr_at(s->if_stmt.elseifs[i].cond));
+            }
+            walk_push_block(w, s->if_stmt.then_block);
+            walk_push(w, AST_EXPR, expr_at(s->if_stmt.cond));
+            break;
+        case STMT_FOR:
+            walk_push_block(w, s->for_stmt.block);
+            walk_push(w, AST_STMT, stmt_at(s->for_stmt.next));
+            walk_push(w, AST_EXPR, expr_at(s->for_stmt.cond));
+            walk_push(w, AST_STMT, stmt_at(s->for_stmt.init));
+            break;
+        case STMT_WHILE:
+            walk_push_block(w, s->while_stmt.block);
+            walk_push(w, AST_EXPR, expr_at(s->while_stmt.cond));
+            break;
+        case STMT_SWITCH:
+            for(u32 i = s->switch_stmt.num_cases; i-- > 0;)
+            {
+                switch_case* c = &s->switch_stmt.cases[i];
+                walk_push_block(w, c->block);
+                walk_push_list(w, AST_EXPR, c->exprs, c->num_exprs);
+            }
+            walk_push(w, AST_EXPR, expr_at(s->switch_stmt.expr));
+            break;
+        case STMT_INIT:
+            walk_push(w, AST_EXPR, expr_at(s->init.expr));
+            break;
+        case STMT_ASSIGN:
+            walk_push(w, AST_EXPR, expr_at(s->assign.right));
+            walk_push(w, AST_EXPR, expr_at(s->assign.left));
+            break;
+        case STMT_EXPR:
+            walk_push(w, AST_EXPR, expr_at(s->expr));
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+    default:
+        assert(0);
+    }
+}
+
+// Walks the tree under root. Returns false if a callback stopped the walk.
+bool ast_walk(ast_walker* w, ast_kind kind, void* root)
+{
+    buf_clear(w->stack);
+    walk_push(w, kind, root);
+    while(buf_len(w->stack))
+    {
+        walk_item* top = &w->stack[buf_len(w->stack) - 1];
+        ast_node node = {top->kind, .node = top->node};
+        if(top->num_list)
+        {
+            node.node = node.kind == AST_TYPESPEC ? *top->list++ : (void*)ast_at(*top->refs++);
+            if(--top->num_list == 0)
+            {
+                buf__hdr(w->stack)->len--;
+            }
+        }
+        else
+        {
+            buf__hdr(w->stack)->len--;
+            if(top->post)
+            {
+                if(w->post(w->ctx, node) == WALK_STOP)
+                {
+                    return false;
+                }
+                continue;
+            }
+        }
+        if(!node.node)
+        {
+            continue;
+        }
+        walk_action action = w->pre ? w->pre(w->ctx, node) : WALK_CONTINUE;
+        if(action == WALK_STOP)
+        {
+            return false;
+        }
+        if(action == WALK_SKIP)
+        {
+            continue;
+        }
+        if(w->post)
+        {
+            buf_push(w->stack, (walk_item){node.kind, true, .node = node.node});
+        }
+        walk_push_children(w, node);
+    }
+    return true;
+}
+
+void ast_walker_free(ast_walker* w)
+{
+    buf_free(w->stack);
+}
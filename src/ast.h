@@ -2,12 +2,19 @@ typedef struct typespec typespec;
 typedef struct decl decl;
 typedef struct expr expr;
 typedef struct stmt stmt;
+typedef struct sym sym;
+typedef struct Type Type;
+
+// Expressions and statements refer to the expressions and statements under
+// them by 32-bit handle instead of by pointer, see ast_ref. Zero is no node.
+typedef u32 expr_ref;
+typedef u32 stmt_ref;
 
 //Statement block, fuck this name
 typedef struct
 {
-    stmt **stmt;
-    size_t num_stmts;
+    stmt_ref *stmt;
+    u32 num_stmts;
 }s_block;
 
 typedef enum
@@ -22,10 +29,10 @@ typedef enum
 
 typedef struct
 {
-    size_t num_args; 
     typespec** args;
     typespec** rets;
-    size_t num_rets;
+    u32 num_args;
+    u32 num_rets;
 }func_typespec;
 
 typedef struct
@@ -39,13 +46,23 @@ typedef struct
     expr* size;
 }array_typespec;
 
+// Every node starts with a small header and is allocated only as large as the
+// union member its kind uses, see the *_sizes tables in ast.c. So nodes must
+// never be copied by value.
 struct typespec
 {
-    typespec_type type;
+    u8 type;
+    u32 pos;
 
     union 
     {
-        const char* name;
+        // sym is set by the resolver. Named typespecs are shared, so they
+        // can only ever name a global type.
+        struct
+        {
+            const char* name;
+            sym* sym;
+        };
         func_typespec func;
         ptr_typespec ptr;
         array_typespec array;
@@ -73,7 +90,7 @@ typedef struct
 typedef struct
 {
     enum_item* items;
-    size_t num_items;
+    u32 num_items;
 }enum_decl;
 
 typedef struct
@@ -86,7 +103,7 @@ typedef struct
 typedef struct
 {
     aggregate_item* items;
-    size_t num_items;
+    u32 num_items;
 }aggregate_decl;
 
 typedef struct
@@ -97,6 +114,7 @@ typedef struct
 
 typedef struct
 {
+    typespec* type;
     expr* expr;
 }const_decl;
 
@@ -106,19 +124,26 @@ typedef struct
     typespec* type;
 }func_item;
 
+// When bodies are parsed lazily, body points at the body's opening brace and
+// block stays empty until func_decl_body is first called.
 typedef struct
 {
     func_item* param_list;
-    size_t num_params;
     typespec** return_type;
-    size_t num_return;
+    u32 num_params;
+    u32 num_return;
     s_block block;
+    token_cursor body;
 }func_decl;
 
+// sym is set by the resolver for declarations at file scope and for
+// variables and constants declared in a function.
 struct decl
 {
-    decl_type type;
+    u8 type;
+    u32 pos;
     const char* name;
+    sym* sym;
     union
     {
         enum_decl enum_decl;
@@ -149,64 +174,69 @@ typedef enum
 typedef struct
 {
     typespec* type;
-    expr* expr;
+    expr_ref expr;
 }cast_expr;
 
 typedef struct
 {
-    expr* expr;
-    expr** args;
-    size_t num_args;
+    expr_ref expr;
+    u32 num_args;
+    expr_ref* args;
 }call_expr;
 
 typedef struct
 {
-    expr* expr;
-    expr* index;
+    expr_ref expr;
+    expr_ref index;
 }index_expr;
 
 typedef struct
 {
-    expr* expr;
+    expr_ref expr;
     const char* name;
 }field_expr;
 
 typedef struct
 {
     typespec* type;
-    expr** args;
-    size_t num_args;
+    expr_ref* args;
+    u32 num_args;
 }compound_expr;
 
 typedef struct
 {
-    token_type op;
-    expr* expr;
+    expr_ref expr;
 }unary_expr;
 
 typedef struct
 {
-    token_type op;
-    expr* left;
-    expr* right;
+    expr_ref left;
+    expr_ref right;
 }binary_expr;
 
 typedef struct
 {
-    expr* cond;
-    expr* then_expr;
-    expr* else_expr;
+    expr_ref cond;
+    expr_ref then_expr;
+    expr_ref else_expr;
 }ternary_expr;
 
+// op is the operator of unary and binary expressions.
 struct expr
 {
-    expr_type type;
+    u8 type;
+    u8 op;
+    u32 pos;
     union
     {
         u64 int_val;
         f64 float_val;
         const char* str_val;
-        const char* name;
+        struct
+        {
+            const char* name;
+            sym* sym;
+        };
         cast_expr cast;
         call_expr call;
         index_expr index;
@@ -237,71 +267,74 @@ typedef enum
 
 typedef struct
 {
-    expr* expr;
+    expr_ref expr;
 }return_stmt;
 
 typedef struct
 {
-    expr* cond;
+    expr_ref cond;
     s_block block;
 }else_if;
 
 typedef struct
 {
-    expr* cond;
+    expr_ref cond;
+    u32 num_elseifs;
     s_block then_block;
     else_if* elseifs;
-    size_t num_elseifs;
     s_block else_block;
 }if_stmt;
 
 //TODO: For each loops
 typedef struct
 {
-    stmt* init;
-    expr* cond;
-    stmt* next;
+    stmt_ref init;
+    expr_ref cond;
+    stmt_ref next;
     s_block block;
 }for_stmt;
 
 typedef struct
 {
-    expr* cond;
+    expr_ref cond;
     s_block block;
 }while_stmt;
 
 //TODO: lambdas for switch statements and in general
 typedef struct
 {
-    expr **exprs;
-    size_t num_exprs;
+    expr_ref *exprs;
+    u32 num_exprs;
     bool is_default;
     s_block block;
 }switch_case;
 
 typedef struct
 {
-    expr* expr;
+    expr_ref expr;
+    u32 num_cases;
     switch_case* cases;
-    size_t num_cases;
 }switch_stmt;
 
 typedef struct
 {
     const char* name;
-    expr* expr;
+    expr_ref expr;
+    sym* sym;
 }init_stmt;
 
 typedef struct
 {
-    token_type op;
-    expr* left;
-    expr* right;
+    expr_ref left;
+    expr_ref right;
 }assign_stmt;
 
+// op is the operator of assignments.
 struct stmt
 {
-    stmt_type type;
+    u8 type;
+    u8 op;
+    u32 pos;
     union 
     {
         return_stmt return_stmt;
@@ -312,7 +345,64 @@ struct stmt
         s_block block;
         init_stmt init;
         assign_stmt assign;
-        expr* expr;
+        expr_ref expr;
         decl* decl;
     };
 };
+
+typedef enum
+{
+    AST_NONE,
+    AST_TYPESPEC,
+    AST_DECL,
+    AST_EXPR,
+    AST_STMT,
+}ast_kind;
+
+typedef struct
+{
+    u8 kind;
+    union
+    {
+        void* node;
+        typespec* type;
+        decl* decl;
+        expr* expr;
+        stmt* stmt;
+    };
+}ast_node;
+
+typedef enum
+{
+    WALK_CONTINUE,
+    // Returned from pre: don't visit the node's children or call its post.
+    WALK_SKIP,
+    WALK_STOP,
+}walk_action;
+
+typedef walk_action (*walk_func)(void* ctx, ast_node node);
+
+// Pending work of a walk. A list entry hands out the elements of one of the
+// AST's child arrays in order, so siblings are visited front to back straight
+// out of their array and the stack only grows with the depth of the tree.
+// Expression and statement lists hold handles, typespec lists pointers.
+typedef struct
+{
+    u8 kind;
+    bool post;
+    u32 num_list;
+    union
+    {
+        void* node;
+        void** list;
+        u32* refs;
+    };
+}walk_item;
+
+typedef struct
+{
+    walk_func pre;
+    walk_func post;
+    void* ctx;
+    walk_item* stack;
+}ast_walker;
@@ -0,0 +1,515 @@
+// Front end throughput benchmark. `uct bench` generates a synthetic corpus
+// and times the lexer, the token cursor and the parser over it. The generator
+// is seeded, so a given shape, size and seed always produce the same source
+// and runs can be compared against a saved baseline.
+
+#undef MEM_TAG
+#define MEM_TAG MEM_OTHER
+
+typedef enum
+{
+    SHAPE_MIXED,
+    SHAPE_FUNCTIONS,
+    SHAPE_DEEP,
+    SHAPE_LITERALS,
+    SHAPE_IDENTS,
+    SHAPE_COMMENTS,
+    SHAPE_STRINGS,
+    NUM_SHAPES,
+} bench_shape;
+
+const char* bench_shape_names[NUM_SHAPES] =
+{
+    [SHAPE_MIXED] = "mixed",
+    [SHAPE_FUNCTIONS] = "functions",
+    [SHAPE_DEEP] = "deep",
+    [SHAPE_LITERALS] = "literals",
+    [SHAPE_IDENTS] = "idents",
+    [SHAPE_COMMENTS] = "comments",
+    [SHAPE_STRINGS] = "strings",
+};
+
+typedef struct
+{
+    char* text;
+    u64 rng;
+    u32 next_id;
+    int indent;
+} bench_gen;
+
+static u32 gen_rand(bench_gen* g, u32 n)
+{
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return (u32)((g->rng*0x2545F4914F6CDD1Dull) >> 32) % n;
+}
+
+static const char* gen_pick(bench_gen* g, const char** items, size_t num)
+{
+    return items[gen_rand(g, (u32)num)];
+}
+
+#define GEN_PICK(g, items) gen_pick((g), (items), sizeof(items)/sizeof(*(items)))
+
+static const char* gen_types[] = {"i32", "i64", "u8", "f32", "f64", "i32^", "f32[4]", "u8^[16]"};
+static const char* gen_binary_ops[] = {"+", "-", "*", "/", "%", "<<", ">>", "&", "<", ">", "==", "!=", "<=", ">=", "&&", "||"};
+static const char* gen_assign_ops[] = {"=", "+=", "-=", "*=", "/=", "<<=", ">>="};
+
+static void gen_expr(bench_gen* g, int depth)
+{
+    if(depth <= 0 || gen_rand(g, 4) == 0)
+    {
+        switch(gen_rand(g, 4))
+        {
+        case 0:
+            buf_printf(g->text, "%u", gen_rand(g, 100000));
+            break;
+        case 1:
+            buf_printf(g->text, "%u.%u", gen_rand(g, 1000), gen_rand(g, 1000));
+            break;
+        default:
+            buf_printf(g->text, "%c%u", 'a' + gen_rand(g, 26), gen_rand(g, 10));
+            break;
+        }
+        return;
+    }
+    switch(gen_rand(g, 8))
+    {
+    case 0:
+        buf_printf(g->text, "(");
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, ")");
+        break;
+    case 1:
+        buf_printf(g->text, "%s(", gen_rand(g, 2) ? "-" : "!");
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, ")");
+        break;
+    case 2:
+        buf_printf(g->text, "f%u(", gen_rand(g, 100));
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, ", ");
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, ")");
+        break;
+    case 3:
+        buf_printf(g->text, "v%u[", gen_rand(g, 100));
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, "].field%u", gen_rand(g, 4));
+        break;
+    case 4:
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, " ? ");
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, " : ");
+        gen_expr(g, depth - 1);
+        break;
+    default:
+        gen_expr(g, depth - 1);
+        buf_printf(g->text, " %s ", GEN_PICK(g, gen_binary_ops));
+        gen_expr(g, depth - 1);
+        break;
+    }
+}
+
+static void gen_block(bench_gen* g, int depth);
+
+static void gen_stmt(bench_gen* g, int depth)
+{
+    u32 kind = depth > 0 ? gen_rand(g, 10) : 6 + gen_rand(g, 4);
+    switch(kind)
+    {
+    case 0:
+        buf_printf(g->text, "if(");
+        gen_expr(g, 2);
+        buf_printf(g->text, ") ");
+        gen_block(g, depth - 1);
+        buf_printf(g->text, " else if(");
+        gen_expr(g, 2);
+        buf_printf(g->text, ") ");
+        gen_block(g, depth - 1);
+        buf_printf(g->text, " else ");
+        gen_block(g, depth - 1);
+        break;
+    case 1:
+        buf_printf(g->text, "for(i := 0; i < %u; i++) ", gen_rand(g, 100));
+        gen_block(g, depth - 1);
+        break;
+    case 2:
+        buf_printf(g->text, "while(");
+        gen_expr(g, 2);
+        buf_printf(g->text, ") ");
+        gen_block(g, depth - 1);
+        break;
+    case 3:
+        buf_printf(g->text, "switch(x) { => %u => %u ", gen_rand(g, 10), 10 + gen_rand(g, 10));
+        gen_stmt(g, 0);
+        buf_printf(g->text, " break; _ ");
+        gen_stmt(g, 0);
+        buf_printf(g->text, " }");
+        break;
+    case 4:
+        gen_block(g, depth - 1);
+        break;
+    case 5:
+        buf_printf(g->text, "let l%u: %s = ", gen_rand(g, 1000), GEN_PICK(g, gen_types));
+        gen_expr(g, 2);
+        buf_printf(g->text, ";");
+        break;
+    case 6:
+        buf_printf(g->text, "t%u := ", gen_rand(g, 1000));
+        gen_expr(g, 3);
+        buf_printf(g->text, ";");
+        break;
+    case 7:
+        buf_printf(g->text, "x%u %s ", gen_rand(g, 10), GEN_PICK(g, gen_assign_ops));
+        gen_expr(g, 3);
+        buf_printf(g->text, ";");
+        break;
+    case 8:
+        buf_printf(g->text, "n%u++;", gen_rand(g, 10));
+        break;
+    default:
+        buf_printf(g->text, "return ");
+        gen_expr(g, 3);
+        buf_printf(g->text, ";");
+        break;
+    }
+}
+
+static void gen_block(bench_gen* g, int depth)
+{
+    buf_printf(g->text, "{\n");
+    g->indent++;
+    for(u32 i = 1 + gen_rand(g, 4); i > 0; i--)
+    {
+        buf_printf(g->text, "%*s", 4*g->indent, "");
+        gen_stmt(g, depth);
+        buf_printf(g->text, "\n");
+    }
+    g->indent--;
+    buf_printf(g->text, "%*s}", 4*g->indent, "");
+}
+
+static void gen_functions(bench_gen* g)
+{
+    u32 id = g->next_id++;
+    switch(gen_rand(g, 6))
+    {
+    case 0:
+        buf_printf(g->text, "struct s%u { a: i32; b: f32 = 1.5; c: %s; }\n", id, GEN_PICK(g, gen_types));
+        break;
+    case 1:
+        buf_printf(g->text, "enum e%u { red, green = %u, blue }\n", id, gen_rand(g, 100));
+        break;
+    case 2:
+        buf_printf(g->text, "const k%u = %u;\n", id, gen_rand(g, 1000));
+        break;
+    default:
+        buf_printf(g->text, "fn f%u(x: i32, y: %s): i32 ", id, GEN_PICK(g, gen_types));
+        gen_block(g, 2);
+        buf_printf(g->text, "\n");
+        break;
+    }
+}
+
+static void gen_deep(bench_gen* g)
+{
+    buf_printf(g->text, "let d%u := ", g->next_id++);
+    if(gen_rand(g, 2))
+    {
+        gen_expr(g, 12);
+    }
+    else
+    {
+        u32 depth = 32 + gen_rand(g, 64);
+        for(u32 i = 0; i < depth; i++)
+        {
+            buf_printf(g->text, "(a%u %s ", i % 10, GEN_PICK(g, gen_binary_ops));
+        }
+        buf_printf(g->text, "b");
+        for(u32 i = 0; i < depth; i++)
+        {
+            buf_printf(g->text, ")");
+        }
+    }
+    buf_printf(g->text, ";\n");
+}
+
+static void gen_literals(bench_gen* g)
+{
+    bool floats = gen_rand(g, 2);
+    u32 num = 256 + gen_rand(g, 1024);
+    buf_printf(g->text, "let t%u: %s[%u] = {", g->next_id++, floats ? "f64" : "i32", num);
+    for(u32 i = 0; i < num; i++)
+    {
+        if(floats)
+        {
+            buf_printf(g->text, "%s%u.%u", i ? ", " : "", gen_rand(g, 100000), gen_rand(g, 1000));
+        }
+        else
+        {
+            buf_printf(g->text, "%s%u", i ? ", " : "", gen_rand(g, 1000000));
+        }
+        if(i % 16 == 15)
+        {
+            buf_printf(g->text, "\n    ");
+        }
+    }
+    buf_printf(g->text, "};\n");
+}
+
+static void gen_ident(bench_gen* g)
+{
+    static const char* words[] = {"buffer", "context", "allocator", "index", "request", "handler", "result", "count", "session", "token"};
+    for(u32 i = 2 + gen_rand(g, 6); i > 0; i--)
+    {
+        buf_printf(g->text, "%s_", GEN_PICK(g, words));
+    }
+    buf_printf(g->text, "%u", gen_rand(g, 1000));
+}
+
+static void gen_idents(bench_gen* g)
+{
+    buf_printf(g->text, "fn ");
+    gen_ident(g);
+    buf_printf(g->text, "_%u(", g->next_id++);
+    gen_ident(g);
+    buf_printf(g->text, ": i32): i32\n{\n");
+    for(u32 i = 1 + gen_rand(g, 4); i > 0; i--)
+    {
+        buf_printf(g->text, "    ");
+        gen_ident(g);
+        buf_printf(g->text, " := ");
+        gen_ident(g);
+        buf_printf(g->text, " + ");
+        gen_ident(g);
+        buf_printf(g->text, ".");
+        gen_ident(g);
+        buf_printf(g->text, ";\n");
+    }
+    buf_printf(g->text, "    return 0;\n}\n");
+}
+
+static void gen_comments(bench_gen* g)
+{
+    static const char* lines[] =
+    {
+        "Returns the number of elements that are still waiting to be processed.",
+        "TODO: this should be folded into the caller once the new layout lands.",
+        "  - keep in sync with the table in the driver",
+        "",
+        "Note that the order matters here: the second pass relies on the first.",
+    };
+    for(u32 i = 2 + gen_rand(g, 8); i > 0; i--)
+    {
+        buf_printf(g->text, "// %s\n", GEN_PICK(g, lines));
+    }
+    buf_printf(g->text, "let c%u := %u; // %s\n", g->next_id++, gen_rand(g, 100), GEN_PICK(g, lines));
+}
+
+static void gen_strings(bench_gen* g)
+{
+    static const char* pieces[] =
+    {
+        "error: ", "could not open ", "%s", " (", ")", "\\n", "\\t", "\\\"quoted\\\"", "C:\\\\path\\\\to\\\\file", "done",
+    };
+    u32 num = 1 + gen_rand(g, 8);
+    buf_printf(g->text, "let s%u: u8^[%u] = {", g->next_id++, num);
+    for(u32 i = num; i > 0; i--)
+    {
+        buf_printf(g->text, "\"");
+        for(u32 j = 1 + gen_rand(g, 6); j > 0; j--)
+        {
+            buf_printf(g->text, "%s", GEN_PICK(g, pieces));
+        }
+        buf_printf(g->text, "\"%s", i > 1 ? ", " : "");
+    }
+    buf_printf(g->text, "};\n");
+}
+
+// Generates roughly size bytes of source, always whole declarations.
+char* bench_generate(bench_shape shape, size_t size, u64 seed)
+{
+    bench_gen g = {NULL, seed*0x9E3779B97F4A7C15ull + 1};
+    while(buf_len(g.text) < size)
+    {
+        bench_shape s = shape == SHAPE_MIXED ? 1 + gen_rand(&g, NUM_SHAPES - 1) : shape;
+        switch(s)
+        {
+        case SHAPE_FUNCTIONS:
+            gen_functions(&g);
+            break;
+        case SHAPE_DEEP:
+            gen_deep(&g);
+            break;
+        case SHAPE_LITERALS:
+            gen_literals(&g);
+            break;
+        case SHAPE_IDENTS:
+            gen_idents(&g);
+            break;
+        case SHAPE_STRINGS:
+            gen_strings(&g);
+            break;
+        default:
+            gen_comments(&g);
+            break;
+        }
+    }
+    return g.text;
+}
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Prints min, median, mean and max of the run times, and the throughput at
+// the median. The median is the number to compare, it shrugs off the odd run
+// that got descheduled.
+static void bench_report(const char* name, double* times, int runs, double bytes, double items, const char* item_name)
+{
+    qsort(times, runs, sizeof(*times), compare_doubles);
+    double mean = 0;
+    for(int i = 0; i < runs; i++)
+    {
+        mean += times[i]/runs;
+    }
+    double median = runs % 2 ? times[runs/2] : (times[runs/2 - 1] + times[runs/2])/2;
+    printf("%-10s min %8.3fms  median %8.3fms  mean %8.3fms  max %8.3fms  %8.1f MB/s  %8.2f M%s/s\n", name, times[0]*1e3, median*1e3,
+        mean*1e3, times[runs - 1]*1e3, bytes/median/1e6, items/median/1e6, item_name);
+}
+
+int bench_main(int argc, char** argv)
+{
+    bench_shape shape = SHAPE_MIXED;
+    size_t size = 8*1024*1024;
+    int runs = 10;
+    u64 seed = 1;
+    const char* out = NULL;
+    for(int i = 0; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--shape") == 0 && i + 1 < argc)
+        {
+            i++;
+            shape = NUM_SHAPES;
+            for(int j = 0; j < NUM_SHAPES; j++)
+            {
+                if(strcmp(argv[i], bench_shape_names[j]) == 0)
+                {
+                    shape = j;
+                }
+            }
+            if(shape == NUM_SHAPES)
+            {
+                printf("error: Unknown shape: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            char* end;
+            size = strtoull(argv[++i], &end, 10);
+            size <<= *end == 'k' || *end == 'K' ? 10 : *end == 'm' || *end == 'M' ? 20 : 0;
+        }
+        else if(strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+            runs = CLAMP_MIN(runs, 1);
+        }
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+        {
+            out = argv[++i];
+        }
+        else
+        {
+            printf("usage: uct bench [--shape mixed|functions|deep|literals|idents|comments|strings] [--size n[k|m]] [--runs n] [--seed n] [--out file.uct]\n");
+            return 1;
+        }
+    }
+
+    char* source = bench_generate(shape, size, seed);
+    double bytes = buf_len(source);
+    if(out)
+    {
+        FILE* f = fopen(out, "wb");
+        if(!f)
+        {
+            printf("error: Cannot write %s\n", out);
+            return 1;
+        }
+        fwrite(source, 1, buf_len(source), f);
+        fclose(f);
+        return 0;
+    }
+
+    // One untimed round first to fault in the buffers, the interner and the arena.
+    double* lex_times = calloc(runs, sizeof(double));
+    double* next_times = calloc(runs, sizeof(double));
+    double* parse_times = calloc(runs, sizeof(double));
+    size_t num_tokens = 0;
+    size_t num_decls = 0;
+    // The corpus is registered once, every run lexes it at the same positions.
+    u32 base = source_map_add("<bench>", source, buf_len(source));
+    for(int run = -1; run < runs; run++)
+    {
+        // String literal values are allocated in the AST arena while lexing.
+        arena_reset(&ast_arena);
+        double start = bench_now();
+        tokenize_at(&lex_tokens, "<bench>", source, base);
+        double lexed = bench_now();
+        init_parse_tokens(&lex_tokens);
+        num_tokens = 1;
+        while(!is_token_eof())
+        {
+            next_token();
+            num_tokens++;
+        }
+        double walked = bench_now();
+        init_parse_tokens(&lex_tokens);
+        error_count = 0;
+        num_decls = 0;
+        while(!is_token_eof())
+        {
+            parse_decl();
+            num_decls++;
+        }
+        double parsed = bench_now();
+        if(error_count)
+        {
+            printf("error: Generated source has %d syntax errors\n", error_count);
+            return 1;
+        }
+        if(run >= 0)
+        {
+            lex_times[run] = lexed - start;
+            next_times[run] = walked - lexed;
+            parse_times[run] = parsed - walked;
+        }
+    }
+    printf("shape %s, seed %llu, %.2f MB, %zu tokens, %zu decls, %d runs\n", bench_shape_names[shape], (unsigned long long)seed,
+        bytes/1e6, num_tokens, num_decls, runs);
+    bench_report("lex", lex_times, runs, bytes, (double)num_tokens, "tokens");
+    bench_report("next_token", next_times, runs, bytes, (double)num_tokens, "tokens");
+    bench_report("parse_decl", parse_times, runs, bytes, (double)num_decls, "decls");
+    free(lex_times);
+    free(next_times);
+    free(parse_times);
+    buf_free(source);
+    return 0;
+}
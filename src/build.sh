@@ -3,6 +3,12 @@
 mkdir -p ../bin
 pushd ../bin
 
-gcc ../src/main.c -std=c11 -g -o uct
+if [ "$1" = "bench" ]; then
+    # Optimized build, then run the front end benchmark with any further arguments.
+    shift
+    gcc ../src/main.c -std=c11 -O2 -pthread -o uct_bench && ./uct_bench bench "$@"
+else
+    gcc ../src/main.c -std=c11 -g -pthread -o uct
+fi
 
 popd
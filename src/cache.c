@@ -0,0 +1,814 @@
+// On-disk cache of parsed declarations, keyed by a hash of the source text.
+// A cache file is a file's AST copied out of the arena node by node, with every
+// node pointer replaced by the node's offset in the file, every expression and
+// statement handle by its node's offset over 8, and every string by its
+// 1-based index in a string table, each stored in the link's own field.
+// Positions are stored relative to the file's base in the source map. Loading
+// maps the file copy-on-write and patches those fields in place, so a hit costs
+// one mmap and a walk over the nodes instead of a lex and parse. Only
+// typespecs are rebuilt, since they're hash-consed.
+
+#undef MEM_TAG
+#define MEM_TAG MEM_CACHE
+
+#define AST_CACHE_MAGIC 0x41544355
+#define AST_CACHE_VERSION 4
+// Catches builds whose node layout differs from the one that wrote the file.
+#define AST_CACHE_LAYOUT ((u32)(sizeof(typespec) | sizeof(decl) << 8 | sizeof(expr) << 16 | sizeof(stmt) << 24))
+
+typedef struct
+{
+    u32 magic;
+    u32 version;
+    u32 layout;
+    u32 size;
+    u64 source_hash;
+    // Hash of everything after the header, so truncated or corrupt files are
+    // treated as misses instead of being walked.
+    u64 data_hash;
+    u32 source_len;
+    u32 num_decls;
+    u32 decls;
+    u32 num_strings;
+    u32 strings;
+    u32 reserved;
+} ast_cache_header;
+
+// Directory to keep cache files in. Caching is off while this is NULL.
+const char* ast_cache_dir;
+
+#define CACHE_REF(offset) ((void*)(uintptr_t)(offset))
+#define CACHE_OFFSET(ref) ((u32)(uintptr_t)(ref))
+
+char* ast_cache_path(u64 source_hash)
+{
+    char* path = NULL;
+    buf_printf(path, "%s/%016llx.ast", ast_cache_dir, (unsigned long long)source_hash);
+    return path;
+}
+
+typedef struct
+{
+    char* data;
+    u32 base;
+    u32 len;
+    const char** strings;
+    // Open-addressed map from interned name to string index, so each name is
+    // stored once no matter how often it's used.
+    const char** name_keys;
+    u32* name_vals;
+    size_t name_cap;
+    size_t num_names;
+} ast_writer;
+
+static u32 write_bytes(ast_writer* w, const void* data, size_t size)
+{
+    size_t offset = ALIGN_UP(buf_len(w->data), 8);
+    buf_fit(w->data, offset + size);
+    memset(w->data + buf_len(w->data), 0, offset - buf_len(w->data));
+    memcpy(w->data + offset, data, size);
+    buf__hdr(w->data)->len = offset + size;
+    assert(offset + size <= UINT32_MAX);
+    return (u32)offset;
+}
+
+static const char* write_str(ast_writer* w, const char* str)
+{
+    if(!str)
+    {
+        return NULL;
+    }
+    buf_push(w->strings, str);
+    return CACHE_REF(buf_len(w->strings));
+}
+
+static const char* write_name(ast_writer* w, const char* name)
+{
+    if(!name)
+    {
+        return NULL;
+    }
+    if(2*w->num_names >= w->name_cap)
+    {
+        ast_writer old = *w;
+        w->name_cap = CLAMP_MIN(2*old.name_cap, 64);
+        w->name_keys = calloc(w->name_cap, sizeof(const char*));
+        w->name_vals = calloc(w->name_cap, sizeof(u32));
+        mem_track_alloc(MEM_CACHE, w->name_cap*(sizeof(const char*) + sizeof(u32)));
+        for(size_t i = 0; i < old.name_cap; i++)
+        {
+            if(old.name_keys[i])
+            {
+                size_t j = hash_mix((uintptr_t)old.name_keys[i]) & (w->name_cap - 1);
+                while(w->name_keys[j])
+                {
+                    j = (j + 1) & (w->name_cap - 1);
+                }
+                w->name_keys[j] = old.name_keys[i];
+                w->name_vals[j] = old.name_vals[i];
+            }
+        }
+        free(old.name_keys);
+        free(old.name_vals);
+        mem_track_free(MEM_CACHE, old.name_cap*(sizeof(const char*) + sizeof(u32)));
+    }
+    size_t i = hash_mix((uintptr_t)name) & (w->name_cap - 1);
+    while(w->name_keys[i] && w->name_keys[i] != name)
+    {
+        i = (i + 1) & (w->name_cap - 1);
+    }
+    if(!w->name_keys[i])
+    {
+        w->name_keys[i] = name;
+        w->name_vals[i] = CACHE_OFFSET(write_str(w, name));
+        w->num_names++;
+    }
+    return CACHE_REF(w->name_vals[i]);
+}
+
+static typespec* write_typespec(ast_writer* w, typespec* type);
+static expr* write_expr(ast_writer* w, expr* e);
+static stmt* write_stmt(ast_writer* w, stmt* s);
+static decl* write_decl(ast_writer* w, decl* d);
+
+// Writes an array of num elements of the given size, or nothing when it's
+// empty, matching ast_dup.
+static void* write_array(ast_writer* w, const void* items, size_t num, size_t size)
+{
+    return num ? CACHE_REF(write_bytes(w, items, num*size)) : NULL;
+}
+
+static typespec** write_typespecs(ast_writer* w, typespec** types, size_t num)
+{
+    small_buf(typespec*, 4) refs = {0};
+    for(size_t i = 0; i < num; i++)
+    {
+        small_buf_push(refs, write_typespec(w, types[i]));
+    }
+    typespec** ref = write_array(w, small_buf_items(refs), num, sizeof(*refs.inline_items));
+    small_buf_free(refs);
+    return ref;
+}
+
+static expr_ref write_expr_ref(ast_writer* w, expr_ref ref)
+{
+    return CACHE_OFFSET(write_expr(w, expr_at(ref))) >> 3;
+}
+
+static stmt_ref write_stmt_ref(ast_writer* w, stmt_ref ref)
+{
+    return CACHE_OFFSET(write_stmt(w, stmt_at(ref))) >> 3;
+}
+
+static expr_ref* write_exprs(ast_writer* w, expr_ref* exprs, size_t num)
+{
+    small_buf(expr_ref, 4) refs = {0};
+    for(size_t i = 0; i < num; i++)
+    {
+        small_buf_push(refs, write_expr_ref(w, exprs[i]));
+    }
+    expr_ref* ref = write_array(w, small_buf_items(refs), num, sizeof(*refs.inline_items));
+    small_buf_free(refs);
+    return ref;
+}
+
+static s_block write_block(ast_writer* w, s_block block)
+{
+    small_buf(stmt_ref, 8) refs = {0};
+    for(size_t i = 0; i < block.num_stmts; i++)
+    {
+        small_buf_push(refs, write_stmt_ref(w, block.stmt[i]));
+    }
+    s_block ref = {write_array(w, small_buf_items(refs), block.num_stmts, sizeof(*refs.inline_items)), block.num_stmts};
+    small_buf_free(refs);
+    return ref;
+}
+
+static typespec* write_typespec(ast_writer* w, typespec* type)
+{
+    if(!type)
+    {
+        return NULL;
+    }
+    typespec copy;
+    memcpy(&copy, type, typespec_sizes[type->type]);
+    // A canonical typespec may have been first written in another file.
+    copy.pos = type->pos - w->base <= w->len ? type->pos - w->base : 0;
+    switch(type->type)
+    {
+    case TYPESPEC_NAME:
+        copy.name = write_name(w, type->name);
+        copy.sym = NULL;
+        break;
+    case TYPESPEC_FUNC:
+        copy.func.args = write_typespecs(w, type->func.args, type->func.num_args);
+        copy.func.rets = write_typespecs(w, type->func.rets, type->func.num_rets);
+        break;
+    case TYPESPEC_ARRAY:
+        copy.array.elem = write_typespec(w, type->array.elem);
+        copy.array.size = write_expr(w, type->array.size);
+        break;
+    case TYPESPEC_PTR:
+        copy.ptr.elem = write_typespec(w, type->ptr.elem);
+        break;
+    default:
+        break;
+    }
+    return CACHE_REF(write_bytes(w, &copy, typespec_sizes[type->type]));
+}
+
+static expr* write_expr(ast_writer* w, expr* e)
+{
+    if(!e)
+    {
+        return NULL;
+    }
+    expr copy;
+    memcpy(&copy, e, expr_sizes[e->type]);
+    copy.pos -= w->base;
+    switch(e->type)
+    {
+    case EXPR_STR:
+        copy.str_val = write_str(w, e->str_val);
+        break;
+    case EXPR_NAME:
+        copy.name = write_name(w, e->name);
+        copy.sym = NULL;
+        break;
+    case EXPR_CAST:
+        copy.cast.type = write_typespec(w, e->cast.type);
+        copy.cast.expr = write_expr_ref(w, e->cast.expr);
+        break;
+    case EXPR_CALL:
+        copy.call.expr = write_expr_ref(w, e->call.expr);
+        copy.call.args = write_exprs(w, e->call.args, e->call.num_args);
+        break;
+    case EXPR_INDEX:
+        copy.index.expr = write_expr_ref(w, e->index.expr);
+        copy.index.index = write_expr_ref(w, e->index.index);
+        break;
+    case EXPR_FIELD:
+        copy.field.expr = write_expr_ref(w, e->field.expr);
+        copy.field.name = write_name(w, e->field.name);
+        break;
+    case EXPR_COMPOUND:
+        copy.compound.type = write_typespec(w, e->compound.type);
+        copy.compound.args = write_exprs(w, e->compound.args, e->compound.num_args);
+        break;
+    case EXPR_UNARY:
+        copy.unary.expr = write_expr_ref(w, e->unary.expr);
+        break;
+    case EXPR_BINARY:
+        copy.binary.left = write_expr_ref(w, e->binary.left);
+        copy.binary.right = write_expr_ref(w, e->binary.right);
+        break;
+    case EXPR_TERNARY:
+        copy.ternary.cond = write_expr_ref(w, e->ternary.cond);
+        copy.ternary.then_expr = write_expr_ref(w, e->ternary.then_expr);
+        copy.ternary.else_expr = write_expr_ref(w, e->ternary.else_expr);
+        break;
+    default:
+        break;
+    }
+    return CACHE_REF(write_bytes(w, &copy, expr_sizes[e->type]));
+}
+
+static stmt* write_stmt(ast_writer* w, stmt* s)
+{
+    if(!s)
+    {
+        return NULL;
+    }
+    stmt copy;
+    memcpy(&copy, s, stmt_sizes[s->type]);
+    copy.pos -= w->base;
+    switch(s->type)
+    {
+    case STMT_DECL:
+        copy.decl = write_decl(w, s->decl);
+        break;
+    case STMT_RETURN:
+        copy.return_stmt.expr = write_expr_ref(w, s->return_stmt.expr);
+        break;
+    case STMT_BLOCK:
+        copy.block = write_block(w, s->block);
+        break;
+    case STMT_IF:
+    {
+        small_buf(else_if, 4) elseifs = {0};
+        for(size_t i = 0; i < s->if_stmt.num_elseifs; i++)
+        {
+            else_if* elseif = &s->if_stmt.elseifs[i];
+            small_buf_push(elseifs, (else_if){write_expr_ref(w, elseif->cond), write_block(w, elseif->block)});
+        }
+        copy.if_stmt.cond = write_expr_ref(w, s->if_stmt.cond);
+        copy.if_stmt.then_block = write_block(w, s->if_stmt.then_block);
+        copy.if_stmt.elseifs = write_array(w, small_buf_items(elseifs), small_buf_len(elseifs), sizeof(*elseifs.inline_items));
+        copy.if_stmt.else_block = write_block(w, s->if_stmt.else_block);
+        small_buf_free(elseifs);
+        break;
+    }
+    case STMT_FOR:
+        copy.for_stmt.init = write_stmt_ref(w, s->for_stmt.init);
+        copy.for_stmt.cond = write_expr_ref(w, s->for_stmt.cond);
+        copy.for_stmt.next = write_stmt_ref(w, s->for_stmt.next);
+        copy.for_stmt.block = write_block(w, s->for_stmt.block);
+        break;
+    case STMT_WHILE:
+        copy.while_stmt.cond = write_expr_ref(w, s->while_stmt.cond);
+        copy.while_stmt.block = write_block(w, s->while_stmt.block);
+        break;
+    case STMT_SWITCH:
+    {
+        small_buf(switch_case, 4) cases = {0};
+        for(size_t i = 0; i < s->switch_stmt.num_cases; i++)
+        {
+            switch_case c = s->switch_stmt.cases[i];
+            c.exprs = write_exprs(w, c.exprs, c.num_exprs);
+            c.block = write_block(w, c.block);
+            small_buf_push(cases, c);
+        }
+        copy.switch_stmt.expr = write_expr_ref(w, s->switch_stmt.expr);
+        copy.switch_stmt.cases = write_array(w, small_buf_items(cases), small_buf_len(cases), sizeof(*cases.inline_items));
+        small_buf_free(cases);
+        break;
+    }
+    case STMT_INIT:
+        copy.init.name = write_name(w, s->init.name);
+        copy.init.expr = write_expr_ref(w, s->init.expr);
+        copy.init.sym = NULL;
+        break;
+    case STMT_ASSIGN:
+        copy.assign.left = write_expr_ref(w, s->assign.left);
+        copy.assign.right = write_expr_ref(w, s->assign.right);
+        break;
+    case STMT_EXPR:
+        copy.expr = write_expr_ref(w, s->expr);
+        break;
+    default:
+        break;
+    }
+    return CACHE_REF(write_bytes(w, &copy, stmt_sizes[s->type]));
+}
+
+static decl* write_decl(ast_writer* w, decl* d)
+{
+    decl copy;
+    memcpy(&copy, d, decl_sizes[d->type]);
+    copy.pos -= w->base;
+    copy.name = write_name(w, d->name);
+    copy.sym = NULL;
+    switch(d->type)
+    {
+    case DECL_ENUM:
+    {
+        small_buf(enum_item, 4) items = {0};
+        for(size_t i = 0; i < d->enum_decl.num_items; i++)
+        {
+            enum_item* item = &d->enum_decl.items[i];
+            small_buf_push(items, (enum_item){write_name(w, item->name), write_expr(w, item->init)});
+        }
+        copy.enum_decl.items = write_array(w, small_buf_items(items), small_buf_len(items), sizeof(*items.inline_items));
+        small_buf_free(items);
+        break;
+    }
+    case DECL_STRUCT:
+    case DECL_UNION:
+    {
+        small_buf(aggregate_item, 4) items = {0};
+        for(size_t i = 0; i < d->aggregate_decl.num_items; i++)
+        {
+            aggregate_item* item = &d->aggregate_decl.items[i];
+            small_buf_push(items, (aggregate_item){write_name(w, item->name), write_typespec(w, item->type), write_expr(w, item->init)});
+        }
+        copy.aggregate_decl.items = write_array(w, small_buf_items(items), small_buf_len(items), sizeof(*items.inline_items));
+        small_buf_free(items);
+        break;
+    }
+    case DECL_VAR:
+        copy.var_decl.type = write_typespec(w, d->var_decl.type);
+        copy.var_decl.expr = write_expr(w, d->var_decl.expr);
+        break;
+    case DECL_CONST:
+        copy.const_decl.type = write_typespec(w, d->const_decl.type);
+        copy.const_decl.expr = write_expr(w, d->const_decl.expr);
+        break;
+    case DECL_FUNC:
+    {
+        // Lazily skipped bodies refer to a token buffer and can't be cached.
+        assert(!d->func_decl.body.tokens);
+        small_buf(func_item, 4) params = {0};
+        for(size_t i = 0; i < d->func_decl.num_params; i++)
+        {
+            func_item* param = &d->func_decl.param_list[i];
+            small_buf_push(params, (func_item){write_name(w, param->name), write_typespec(w, param->type)});
+        }
+        copy.func_decl.param_list = write_array(w, small_buf_items(params), small_buf_len(params), sizeof(*params.inline_items));
+        copy.func_decl.return_type = write_typespecs(w, d->func_decl.return_type, d->func_decl.num_return);
+        copy.func_decl.block = write_block(w, d->func_decl.block);
+        small_buf_free(params);
+        break;
+    }
+    default:
+        break;
+    }
+    return CACHE_REF(write_bytes(w, &copy, decl_sizes[d->type]));
+}
+
+// Writes the declarations parsed from a source file. base is the file's base
+// position in the source map. The file is written under a temporary name and
+// renamed into place, so concurrent readers never see a partial file.
+void ast_cache_store(u64 source_hash, size_t source_len, u32 base, decl** decls, size_t num_decls)
+{
+    ast_writer w = {.base = base, .len = (u32)source_len};
+    ast_cache_header header = {AST_CACHE_MAGIC, AST_CACHE_VERSION, AST_CACHE_LAYOUT};
+    write_bytes(&w, &header, sizeof(header));
+    decl** refs = NULL;
+    for(size_t i = 0; i < num_decls; i++)
+    {
+        buf_push(refs, write_decl(&w, decls[i]));
+    }
+    header.decls = CACHE_OFFSET(write_array(&w, refs, num_decls, sizeof(*refs)));
+    header.num_decls = (u32)num_decls;
+    u32* offsets = NULL;
+    for(size_t i = 0; i < buf_len(w.strings); i++)
+    {
+        u32 len = (u32)strlen(w.strings[i]);
+        buf_push(offsets, write_bytes(&w, &len, sizeof(len)));
+        buf_append(w.data, w.strings[i], len + 1);
+    }
+    header.strings = CACHE_OFFSET(write_array(&w, offsets, buf_len(offsets), sizeof(*offsets)));
+    header.num_strings = (u32)buf_len(offsets);
+    header.source_hash = source_hash;
+    header.source_len = (u32)source_len;
+    header.size = (u32)buf_len(w.data);
+    header.data_hash = hash_bytes(w.data + sizeof(header), header.size - sizeof(header));
+    memcpy(w.data, &header, sizeof(header));
+
+    char* path = ast_cache_path(source_hash);
+    char* temp_path = NULL;
+    buf_printf(temp_path, "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    if(fd >= 0)
+    {
+        bool ok = write(fd, w.data, header.size) == (ssize_t)header.size;
+        close(fd);
+        if(!ok || rename(temp_path, path) != 0)
+        {
+            unlink(temp_path);
+        }
+    }
+    buf_free(temp_path);
+    buf_free(path);
+    buf_free(refs);
+    buf_free(offsets);
+    buf_free(w.data);
+    buf_free(w.strings);
+    free(w.name_keys);
+    free(w.name_vals);
+    mem_track_free(MEM_CACHE, w.name_cap*(sizeof(const char*) + sizeof(u32)));
+}
+
+typedef struct
+{
+    char* base;
+    // Handle of the mapping's first byte.
+    u32 refs;
+    u32 pos_base;
+    const u32* string_offsets;
+    // Interned names by string index, filled in on first use.
+    const char** names;
+} ast_reader;
+
+#define CACHE_NODE(r, ref) ((void*)((r)->base + CACHE_OFFSET(ref)))
+
+static const char* read_str(ast_reader* r, const char* ref)
+{
+    return ref ? r->base + r->string_offsets[CACHE_OFFSET(ref) - 1] + sizeof(u32) : NULL;
+}
+
+static const char* read_name(ast_reader* r, const char* ref)
+{
+    if(!ref)
+    {
+        return NULL;
+    }
+    const char** name = &r->names[CACHE_OFFSET(ref) - 1];
+    if(!*name)
+    {
+        const char* str = read_str(r, ref);
+        u32 len;
+        memcpy(&len, str - sizeof(u32), sizeof(len));
+        *name = str_intern_range(str, str + len);
+    }
+    return *name;
+}
+
+static typespec* read_typespec(ast_reader* r, typespec* ref);
+static expr* read_expr(ast_reader* r, expr* ref);
+static stmt* read_stmt(ast_reader* r, stmt* ref);
+static decl* read_decl(ast_reader* r, decl* ref);
+
+static typespec** read_typespecs(ast_reader* r, typespec** ref, size_t num)
+{
+    typespec** types = ref ? CACHE_NODE(r, ref) : NULL;
+    for(size_t i = 0; i < num; i++)
+    {
+        types[i] = read_typespec(r, types[i]);
+    }
+    return types;
+}
+
+static expr_ref read_expr_ref(ast_reader* r, expr_ref ref)
+{
+    if(!ref)
+    {
+        return 0;
+    }
+    read_expr(r, CACHE_REF((size_t)ref << 3));
+    return r->refs + ref;
+}
+
+static stmt_ref read_stmt_ref(ast_reader* r, stmt_ref ref)
+{
+    if(!ref)
+    {
+        return 0;
+    }
+    read_stmt(r, CACHE_REF((size_t)ref << 3));
+    return r->refs + ref;
+}
+
+static expr_ref* read_exprs(ast_reader* r, expr_ref* ref, size_t num)
+{
+    expr_ref* exprs = ref ? CACHE_NODE(r, ref) : NULL;
+    for(size_t i = 0; i < num; i++)
+    {
+        exprs[i] = read_expr_ref(r, exprs[i]);
+    }
+    return exprs;
+}
+
+static s_block read_block(ast_reader* r, s_block ref)
+{
+    s_block block = {ref.stmt ? CACHE_NODE(r, ref.stmt) : NULL, ref.num_stmts};
+    for(size_t i = 0; i < block.num_stmts; i++)
+    {
+        block.stmt[i] = read_stmt_ref(r, block.stmt[i]);
+    }
+    return block;
+}
+
+// Typespecs are hash-consed, so rather than being patched in place they're
+// rebuilt through their constructors and come back as the canonical nodes.
+static typespec* read_typespec(ast_reader* r, typespec* ref)
+{
+    if(!ref)
+    {
+        return NULL;
+    }
+    typespec* type = CACHE_NODE(r, ref);
+    u32 pos = type->pos + r->pos_base;
+    switch(type->type)
+    {
+    case TYPESPEC_NAME:
+        return typespec_name(pos, read_name(r, type->name));
+    case TYPESPEC_FUNC:
+    {
+        typespec** args = read_typespecs(r, type->func.args, type->func.num_args);
+        typespec** rets = read_typespecs(r, type->func.rets, type->func.num_rets);
+        return typespec_func(pos, args, type->func.num_args, rets, type->func.num_rets);
+    }
+    case TYPESPEC_ARRAY:
+    {
+        typespec* elem = read_typespec(r, type->array.elem);
+        return typespec_array(pos, elem, read_expr(r, type->array.size));
+    }
+    case TYPESPEC_PTR:
+        return typespec_ptr(pos, read_typespec(r, type->ptr.elem));
+    default:
+        return typespec_new(pos, type->type);
+    }
+}
+
+static expr* read_expr(ast_reader* r, expr* ref)
+{
+    if(!ref)
+    {
+        return NULL;
+    }
+    expr* e = CACHE_NODE(r, ref);
+    e->pos += r->pos_base;
+    switch(e->type)
+    {
+    case EXPR_STR:
+        e->str_val = read_str(r, e->str_val);
+        break;
+    case EXPR_NAME:
+        e->name = read_name(r, e->name);
+        break;
+    case EXPR_CAST:
+        e->cast.type = read_typespec(r, e->cast.type);
+        e->cast.expr = read_expr_ref(r, e->cast.expr);
+        break;
+    case EXPR_CALL:
+        e->call.expr = read_expr_ref(r, e->call.expr);
+        e->call.args = read_exprs(r, e->call.args, e->call.num_args);
+        break;
+    case EXPR_INDEX:
+        e->index.expr = read_expr_ref(r, e->index.expr);
+        e->index.index = read_expr_ref(r, e->index.index);
+        break;
+    case EXPR_FIELD:
+        e->field.expr = read_expr_ref(r, e->field.expr);
+        e->field.name = read_name(r, e->field.name);
+        break;
+    case EXPR_COMPOUND:
+        e->compound.type = read_typespec(r, e->compound.type);
+        e->compound.args = read_exprs(r, e->compound.args, e->compound.num_args);
+        break;
+    case EXPR_UNARY:
+        e->unary.expr = read_expr_ref(r, e->unary.expr);
+        break;
+    case EXPR_BINARY:
+        e->binary.left = read_expr_ref(r, e->binary.left);
+        e->binary.right = read_expr_ref(r, e->binary.right);
+        break;
+    case EXPR_TERNARY:
+        e->ternary.cond = read_expr_ref(r, e->ternary.cond);
+        e->ternary.then_expr = read_expr_ref(r, e->ternary.then_expr);
+        e->ternary.else_expr = read_expr_ref(r, e->ternary.else_expr);
+        break;
+    default:
+        break;
+    }
+    return e;
+}
+
+static stmt* read_stmt(ast_reader* r, stmt* ref)
+{
+    if(!ref)
+    {
+        return NULL;
+    }
+    stmt* s = CACHE_NODE(r, ref);
+    s->pos += r->pos_base;
+    switch(s->type)
+    {
+    case STMT_DECL:
+        s->decl = read_decl(r, s->decl);
+        break;
+    case STMT_RETURN:
+        s->return_stmt.expr = read_expr_ref(r, s->return_stmt.expr);
+        break;
+    case STMT_BLOCK:
+        s->block = read_block(r, s->block);
+        break;
+    case STMT_IF:
+        s->if_stmt.cond = read_expr_ref(r, s->if_stmt.cond);
+        s->if_stmt.then_block = read_block(r, s->if_stmt.then_block);
+        s->if_stmt.elseifs = s->if_stmt.elseifs ? CACHE_NODE(r, s->if_stmt.elseifs) : NULL;
+        for(size_t i = 0; i < s->if_stmt.num_elseifs; i++)
+        {
+            else_if* elseif = &s->if_stmt.elseifs[i];
+            elseif->cond = read_expr_ref(r, elseif->cond);
+            elseif->block = read_block(r, elseif->block);
+        }
+        s->if_stmt.else_block = read_block(r, s->if_stmt.else_block);
+        break;
+    case STMT_FOR:
+        s->for_stmt.init = read_stmt_ref(r, s->for_stmt.init);
+        s->for_stmt.cond = read_expr_ref(r, s->for_stmt.cond);
+        s->for_stmt.next = read_stmt_ref(r, s->for_stmt.next);
+        s->for_stmt.block = read_block(r, s->for_stmt.block);
+        break;
+    case STMT_WHILE:
+        s->while_stmt.cond = read_expr_ref(r, s->while_stmt.cond);
+        s->while_stmt.block = read_block(r, s->while_stmt.block);
+        break;
+    case STMT_SWITCH:
+        s->switch_stmt.expr = read_expr_ref(r, s->switch_stmt.expr);
+        s->switch_stmt.cases = s->switch_stmt.cases ? CACHE_NODE(r, s->switch_stmt.cases) : NULL;
+        for(size_t i = 0; i < s->switch_stmt.num_cases; i++)
+        {
+            switch_case* c = &s->switch_stmt.cases[i];
+            c->exprs = read_exprs(r, c->exprs, c->num_exprs);
+            c->block = read_block(r, c->block);
+        }
+        break;
+    case STMT_INIT:
+        s->init.name = read_name(r, s->init.name);
+        s->init.expr = read_expr_ref(r, s->init.expr);
+        break;
+    case STMT_ASSIGN:
+        s->assign.left = read_expr_ref(r, s->assign.left);
+        s->assign.right = read_expr_ref(r, s->assign.right);
+        break;
+    case STMT_EXPR:
+        s->expr = read_expr_ref(r, s->expr);
+        break;
+    default:
+        break;
+    }
+    return s;
+}
+
+static decl* read_decl(ast_reader* r, decl* ref)
+{
+    decl* d = CACHE_NODE(r, ref);
+    d->pos += r->pos_base;
+    d->name = read_name(r, d->name);
+    switch(d->type)
+    {
+    case DECL_ENUM:
+        d->enum_decl.items = d->enum_decl.items ? CACHE_NODE(r, d->enum_decl.items) : NULL;
+        for(size_t i = 0; i < d->enum_decl.num_items; i++)
+        {
+            enum_item* item = &d->enum_decl.items[i];
+            item->name = read_name(r, item->name);
+            item->init = read_expr(r, item->init);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        d->aggregate_decl.items = d->aggregate_decl.items ? CACHE_NODE(r, d->aggregate_decl.items) : NULL;
+        for(size_t i = 0; i < d->aggregate_decl.num_items; i++)
+        {
+            aggregate_item* item = &d->aggregate_decl.items[i];
+            item->name = read_name(r, item->name);
+            item->type = read_typespec(r, item->type);
+            item->init = read_expr(r, item->init);
+        }
+        break;
+    case DECL_VAR:
+        d->var_decl.type = read_typespec(r, d->var_decl.type);
+        d->var_decl.expr = read_expr(r, d->var_decl.expr);
+        break;
+    case DECL_CONST:
+        d->const_decl.type = read_typespec(r, d->const_decl.type);
+        d->const_decl.expr = read_expr(r, d->const_decl.expr);
+        break;
+    case DECL_FUNC:
+        d->func_decl.param_list = d->func_decl.param_list ? CACHE_NODE(r, d->func_decl.param_list) : NULL;
+        for(size_t i = 0; i < d->func_decl.num_params; i++)
+        {
+            func_item* param = &d->func_decl.param_list[i];
+            param->name = read_name(r, param->name);
+            param->type = read_typespec(r, param->type);
+        }
+        d->func_decl.return_type = read_typespecs(r, d->func_decl.return_type, d->func_decl.num_return);
+        d->func_decl.block = read_block(r, d->func_decl.block);
+        break;
+    default:
+        break;
+    }
+    return d;
+}
+
+// Appends the cached declarations for a source file to decls and registers the
+// file with the source map. Returns false if there's no usable cache file. On
+// a hit the mapping is never released, the AST lives in it.
+bool ast_cache_load(decl*** decls, const char* path, const char* text, size_t len, u64 source_hash)
+{
+    char* cache_path = ast_cache_path(source_hash);
+    int fd = open(cache_path, O_RDONLY);
+    buf_free(cache_path);
+    if(fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ast_cache_header) || st.st_size > UINT32_MAX)
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    char* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        return false;
+    }
+    ast_cache_header* header = (ast_cache_header*)base;
+    if(header->magic != AST_CACHE_MAGIC || header->version != AST_CACHE_VERSION || header->layout != AST_CACHE_LAYOUT ||
+       header->size != size || header->source_hash != source_hash || header->source_len != len ||
+       header->data_hash != hash_bytes(base + sizeof(*header), size - sizeof(*header)))
+    {
+        munmap(base, size);
+        return false;
+    }
+    // The mapping stays for good, the loaded nodes live in it.
+    mem_track_alloc(MEM_CACHE, size);
+    ast_reader r = {base, ast_register(base, size), source_map_add(path, text, len), (u32*)(base + header->strings)};
+    r.names = calloc(header->num_strings + 1, sizeof(const char*));
+    mem_track_alloc(MEM_CACHE, (header->num_strings + 1)*sizeof(const char*));
+    decl** refs = (decl**)(base + header->decls);
+    for(size_t i = 0; i < header->num_decls; i++)
+    {
+        buf_push(*decls, read_decl(&r, refs[i]));
+    }
+    free(r.names);
+    mem_track_free(MEM_CACHE, (header->num_strings + 1)*sizeof(const char*));
+    return true;
+}
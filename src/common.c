@@ -21,13 +21,169 @@ typedef uint64_t u64;
 typedef float f32;
 typedef double f64;
 
+// Allocation tracking, turned on by setting UCT_MEM_STATS in the environment.
+// Buffers, arena blocks and tables are counted against the subsystem they
+// belong to and the call site that allocated them, and a report goes to stderr
+// when the process exits. Buffers take their tag from MEM_TAG where the buffer
+// macro is expanded, so each source file defines its own.
+typedef enum
+{
+    MEM_OTHER,
+    MEM_SOURCE,
+    MEM_LEXER,
+    MEM_INTERN,
+    MEM_AST,
+    MEM_SCRATCH,
+    MEM_CACHE,
+    MEM_RESOLVE,
+    MEM_TYPES,
+    MEM_DRIVER,
+    NUM_MEM_TAGS,
+} mem_tag;
+
+#define MEM_TAG MEM_OTHER
+
+const char* mem_tag_names[NUM_MEM_TAGS] =
+{
+    [MEM_OTHER] = "other",
+    [MEM_SOURCE] = "source",
+    [MEM_LEXER] = "lexer",
+    [MEM_INTERN] = "interner",
+    [MEM_AST] = "ast",
+    [MEM_SCRATCH] = "scratch",
+    [MEM_CACHE] = "cache",
+    [MEM_RESOLVE] = "resolve",
+    [MEM_TYPES] = "types",
+    [MEM_DRIVER] = "driver",
+};
+
+// Frees can't be traced back to a call site, so live and peak bytes are only
+// kept per tag. Wasted bytes are arena block tails left behind for a new block.
+typedef struct
+{
+    u64 count;
+    u64 bytes;
+    i64 live;
+    i64 peak;
+    u64 wasted;
+} mem_counts;
+
+typedef struct
+{
+    const char* file;
+    int line;
+    u8 tag;
+    u64 count;
+    u64 bytes;
+} mem_site;
+
+#define MEM_MAX_SITES 1024
+
+static struct
+{
+    bool enabled;
+    pthread_mutex_t lock;
+    mem_counts tags[NUM_MEM_TAGS];
+    mem_site sites[MEM_MAX_SITES];
+    size_t num_sites;
+} mem_stats = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void mem__alloc(u8 tag, const char* file, int line, size_t size)
+{
+    pthread_mutex_lock(&mem_stats.lock);
+    mem_counts* counts = &mem_stats.tags[tag];
+    counts->count++;
+    counts->bytes += size;
+    counts->live += size;
+    counts->peak = MAX(counts->peak, counts->live);
+    size_t i = ((uintptr_t)file*31 + line*7 + tag) & (MEM_MAX_SITES - 1);
+    mem_site* site = &mem_stats.sites[i];
+    while(site->file && (site->file != file || site->line != line || site->tag != tag))
+    {
+        i = (i + 1) & (MEM_MAX_SITES - 1);
+        site = &mem_stats.sites[i];
+    }
+    if(!site->file)
+    {
+        assert(mem_stats.num_sites < MEM_MAX_SITES - 1);
+        *site = (mem_site){file, line, tag};
+        mem_stats.num_sites++;
+    }
+    site->count++;
+    site->bytes += size;
+    pthread_mutex_unlock(&mem_stats.lock);
+}
+
+void mem__free(u8 tag, size_t size)
+{
+    pthread_mutex_lock(&mem_stats.lock);
+    mem_stats.tags[tag].live -= size;
+    pthread_mutex_unlock(&mem_stats.lock);
+}
+
+void mem__waste(u8 tag, size_t size)
+{
+    pthread_mutex_lock(&mem_stats.lock);
+    mem_stats.tags[tag].wasted += size;
+    pthread_mutex_unlock(&mem_stats.lock);
+}
+
+#define mem_track_alloc(tag, size) (mem_stats.enabled ? mem__alloc((tag), __FILE__, __LINE__, (size)) : (void)0)
+#define mem_track_free(tag, size) (mem_stats.enabled ? mem__free((tag), (size)) : (void)0)
+#define mem_track_waste(tag, size) (mem_stats.enabled ? mem__waste((tag), (size)) : (void)0)
+
+static int compare_mem_sites(const void* a, const void* b)
+{
+    u64 x = ((const mem_site*)a)->bytes;
+    u64 y = ((const mem_site*)b)->bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void mem_report()
+{
+    fprintf(stderr, "%-10s %10s %14s %14s %14s %14s\n", "memory", "allocs", "bytes", "peak", "live", "wasted");
+    for(int i = 0; i < NUM_MEM_TAGS; i++)
+    {
+        mem_counts* c = &mem_stats.tags[i];
+        if(c->count)
+        {
+            fprintf(stderr, "%-10s %10llu %14llu %14lld %14lld %14llu\n", mem_tag_names[i], (unsigned long long)c->count,
+                (unsigned long long)c->bytes, (long long)c->peak, (long long)c->live, (unsigned long long)c->wasted);
+        }
+    }
+    mem_site sites[MEM_MAX_SITES];
+    size_t num_sites = 0;
+    for(size_t i = 0; i < MEM_MAX_SITES; i++)
+    {
+        if(mem_stats.sites[i].file)
+        {
+            sites[num_sites++] = mem_stats.sites[i];
+        }
+    }
+    qsort(sites, num_sites, sizeof(*sites), compare_mem_sites);
+    fprintf(stderr, "%-24s %-10s %10s %14s\n", "call site", "tag", "allocs", "bytes");
+    for(size_t i = 0; i < MIN(num_sites, 20); i++)
+    {
+        char where[64];
+        snprintf(where, sizeof(where), "%s:%d", sites[i].file, sites[i].line);
+        fprintf(stderr, "%-24s %-10s %10llu %14llu\n", where, mem_tag_names[sites[i].tag], (unsigned long long)sites[i].count, (unsigned long long)sites[i].bytes);
+    }
+}
+
+void init_mem_tracking()
+{
+    if(getenv("UCT_MEM_STATS"))
+    {
+        mem_stats.enabled = true;
+        atexit(mem_report);
+    }
+}
+
 const char* read_file(const char* filename)
 {
     char* buffer = 0;
     long length;
-    FILE* f= fopen(filename, "r");
-
-    size_t read_length;
+    FILE* f= fopen(filename, "rb");
 
     if(f)
     {
@@ -35,22 +191,110 @@ const char* read_file(const char* filename)
         length = ftell(f);
         fseek(f, 0, SEEK_SET);
         buffer = (char*)malloc(length + 1);
+        mem_track_alloc(MEM_SOURCE, length + 1);
         if(buffer)
         {
-            read_length = fread(buffer, 1, length, f);
+            length = fread(buffer, 1, length, f);
+            buffer[length] = '\0';
         }
         fclose(f);
-
-        buffer[length] = '\0';
     }
     else
     {
-        printf("error: File not found: %s", filename);
-        return false;
+        printf("error: File not found: %s\n", filename);
+        return NULL;
     }
     return buffer;
 }
 
+// A loaded source file. On POSIX systems the file is mapped straight from
+// the page cache instead of being copied. The mapping is always followed by
+// zeroed bytes up to the next page boundary (an extra anonymous page when the
+// file ends exactly on one), so text is '\0' terminated like a C string and
+// the lexer's aligned vector loads never leave mapped memory.
+typedef struct
+{
+    const char* path;
+    const char* text;
+    size_t len;
+    void* map;
+    size_t map_len;
+} source_file;
+
+#ifndef _WIN32
+bool source_load(source_file* file, const char* path)
+{
+    *file = (source_file){path};
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        printf("error: File not found: %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        printf("error: Not a regular file: %s\n", path);
+        close(fd);
+        return false;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = (size_t)st.st_size;
+    size_t map_len = ALIGN_UP(len + 1, page);
+    char* map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    if(len && mmap(map, ALIGN_UP(len, page), PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(map, map_len);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    mem_track_alloc(MEM_SOURCE, map_len);
+    file->text = map;
+    file->len = len;
+    file->map = map;
+    file->map_len = map_len;
+    return true;
+}
+
+void source_unload(source_file* file)
+{
+    if(file->map)
+    {
+        munmap(file->map, file->map_len);
+        mem_track_free(MEM_SOURCE, file->map_len);
+    }
+    *file = (source_file){0};
+}
+#else
+bool source_load(source_file* file, const char* path)
+{
+    *file = (source_file){path};
+    file->text = read_file(path);
+    if(!file->text)
+    {
+        return false;
+    }
+    file->len = strlen(file->text);
+    return true;
+}
+
+void source_unload(source_file* file)
+{
+    if(file->text)
+    {
+        free((void*)file->text);
+        mem_track_free(MEM_SOURCE, file->len + 1);
+    }
+    *file = (source_file){0};
+}
+#endif
+
 int str_len(const char* s)
 {
     int i;
@@ -63,7 +307,8 @@ typedef struct BufHdr
 {
     size_t len;
     size_t cap;
-    char buf[];
+    u8 tag;
+    _Alignas(16) char buf[];
 } BufHdr;
 
 #define buf__hdr(b) ((BufHdr *)((char *)(b) - offsetof(BufHdr, buf)))
@@ -73,13 +318,16 @@ typedef struct BufHdr
 #define buf_end(b) ((b) + buf_len(b))
 #define buf_sizeof(b) ((b) ? buf_len(b)*sizeof(*b) : 0)
 
-#define buf_free(b) ((b) ? (free(buf__hdr(b)), (b) = NULL) : 0)
-#define buf_fit(b, n) ((n) <= buf_cap(b) ? 0 : ((b) = buf__grow((b), (n), sizeof(*(b)))))
+#define buf_free(b) ((b) ? (buf__free((b), sizeof(*(b))), (b) = NULL) : 0)
+#define buf_fit(b, n) ((n) <= buf_cap(b) ? 0 : ((b) = buf__grow((b), (n), sizeof(*(b)), MEM_TAG, __FILE__, __LINE__)))
 #define buf_push(b, ...) (buf_fit((b), 1 + buf_len(b)), (b)[buf__hdr(b)->len++] = (__VA_ARGS__))
-#define buf_printf(b, ...) ((b) = buf__printf((b), __VA_ARGS__))
+#define buf_printf(b, ...) ((b) = buf__printf((b), MEM_TAG, __FILE__, __LINE__, __VA_ARGS__))
 #define buf_clear(b) ((b) ? buf__hdr(b)->len = 0 : 0)
+#define buf_append(b, src, n) (buf_fit((b), (n) + buf_len(b)), memcpy(buf_end(b), (src), (n)*sizeof(*(b))), buf__hdr(b)->len += (n))
 
-void* buf__grow(const void* buf, size_t new_len, size_t elem_size)
+// The tag sticks with the buffer from its first allocation, the call site
+// is whichever one grows it.
+void* buf__grow(const void* buf, size_t new_len, size_t elem_size, u8 tag, const char* file, int line)
 {
     assert(buf_cap(buf) <= (SIZE_MAX - 1)/2);
     size_t new_cap = CLAMP_MIN(2*buf_cap(buf), MAX(new_len, 16));
@@ -88,16 +336,30 @@ void* buf__grow(const void* buf, size_t new_len, size_t elem_size)
     size_t new_size = offsetof(BufHdr, buf) + new_cap*elem_size;
     BufHdr *new_hdr;
     if (buf) {
+        tag = buf__hdr(buf)->tag;
+        if (mem_stats.enabled) {
+            mem__free(tag, offsetof(BufHdr, buf) + buf_cap(buf)*elem_size);
+        }
         new_hdr = realloc(buf__hdr(buf), new_size);
     } else {
         new_hdr = malloc(new_size);
         new_hdr->len = 0;
+        new_hdr->tag = tag;
+    }
+    if (mem_stats.enabled) {
+        mem__alloc(tag, file, line, new_size);
     }
     new_hdr->cap = new_cap;
     return new_hdr->buf;
 }
 
-char* buf__printf(char* buf, const char* fmt, ...)
+void buf__free(void* buf, size_t elem_size)
+{
+    mem_track_free(buf__hdr(buf)->tag, offsetof(BufHdr, buf) + buf_cap(buf)*elem_size);
+    free(buf__hdr(buf));
+}
+
+char* buf__printf(char* buf, u8 tag, const char* file, int line, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
@@ -105,7 +367,7 @@ char* buf__printf(char* buf, const char* fmt, ...)
     size_t n = 1 + vsnprintf(buf_end(buf), cap, fmt, args);
     va_end(args);
     if (n > cap) {
-        buf_fit(buf, n + buf_len(buf));
+        buf = buf__grow(buf, n + buf_len(buf), 1, tag, file, line);
         va_start(args, fmt);
         size_t new_cap = buf_cap(buf) - buf_len(buf);
         n = 1 + vsnprintf(buf_end(buf), new_cap, fmt, args);
@@ -119,54 +381,154 @@ char* buf__printf(char* buf, const char* fmt, ...)
 #define each(item, buf) \
     (typeof(*(buf)) *p = (buf), item = *p; p < &((buf)[buf_len(buf)]); p++, (item) = *p)
 
+// Small vector: the first N elements live inline, so the one or two element
+// lists that make up most of an AST never touch the allocator. Past N it
+// spills to the heap. Declare one with small_buf(T, N) and zero-initialize it.
+#define small_buf(T, N) struct { size_t len; size_t cap; T* heap; T inline_items[N]; }
 
-typedef struct
-{
-    size_t len;
-    const char* str;
-} intern;
+#define small_buf_items(v) ((v).heap ? (v).heap : (v).inline_items)
+#define small_buf_len(v) ((v).len)
+#define small_buf_cap(v) ((v).heap ? (v).cap : sizeof((v).inline_items)/sizeof(*(v).inline_items))
+#define small_buf_end(v) (small_buf_items(v) + small_buf_len(v))
+#define small_buf_sizeof(v) (small_buf_len(v)*sizeof(*(v).inline_items))
 
-static intern* interns;
+#define small_buf_free(v) (small_buf__free((v).heap, (v).cap*sizeof(*(v).inline_items), MEM_TAG), (v).heap = NULL, (v).cap = (v).len = 0)
+#define small_buf_fit(v, n) ((n) <= small_buf_cap(v) ? 0 : small_buf__grow((void**)&(v).heap, &(v).cap, (v).inline_items, (v).len, (n), sizeof(*(v).inline_items), MEM_TAG, __FILE__, __LINE__))
+#define small_buf_push(v, ...) (small_buf_fit((v), 1 + small_buf_len(v)), small_buf_items(v)[(v).len++] = (__VA_ARGS__))
+#define small_buf_append(v, src, n) (small_buf_fit((v), (n) + small_buf_len(v)), memcpy(small_buf_end(v), (src), (n)*sizeof(*(v).inline_items)), (v).len += (n))
+#define small_buf_clear(v) ((v).len = 0)
 
-const char* str_intern_range(const char* start, const char* end)
+void small_buf__grow(void** heap, size_t* cap, const void* inline_items, size_t len, size_t new_len, size_t elem_size, u8 tag, const char* file, int line)
 {
-    size_t len = end - start;
-    for(intern *it = interns; it != buf_end(interns); it++)
+    size_t new_cap = CLAMP_MIN(2*MAX(*cap, len), new_len);
+    assert(new_cap <= SIZE_MAX/elem_size);
+    if(mem_stats.enabled)
     {
-        if(it->len == len && strncmp(it->str, start, len) == 0)
+        if(*heap)
         {
-            return it->str;
+            mem__free(tag, *cap*elem_size);
         }
+        mem__alloc(tag, file, line, new_cap*elem_size);
     }
-    char *str = malloc(len + 1);
-    memcpy(str, start, len);
-    str[len] = 0;
-    buf_push(interns, (intern){len, str});
-    return str;
+    if(*heap)
+    {
+        *heap = realloc(*heap, new_cap*elem_size);
+    }
+    else
+    {
+        *heap = malloc(new_cap*elem_size);
+        memcpy(*heap, inline_items, len*elem_size);
+    }
+    *cap = new_cap;
 }
 
-const char* str_intern(const char* str)
+void small_buf__free(void* heap, size_t size, u8 tag)
 {
-    return str_intern_range(str, str + strlen(str));
+    if(heap)
+    {
+        mem_track_free(tag, size);
+        free(heap);
+    }
 }
 
+
+// Memory arena. Blocks grow geometrically up to ARENA_MAX_BLOCK_SIZE, so a
+// large AST takes a handful of allocations instead of thousands. Blocks are
+// kept by arena_reset and arena_rewind and handed out again in order, so an
+// arena that's rebuilt over and over stops allocating once it has reached its
+// peak size. A zeroed arena is ready to use and backed by malloc.
+typedef enum
+{
+    // Map blocks straight from the OS and fault them in up front.
+    ARENA_POPULATE = 1 << 0,
+    // Ask for transparent huge pages on blocks big enough to use them.
+    ARENA_HUGE_PAGES = 1 << 1,
+} arena_flags;
+
+typedef struct
+{
+    char* base;
+    size_t size;
+    bool mapped;
+} arena_block;
+
 typedef struct
 {
     char *ptr;
     char *end;
-    char **blocks;
+    arena_block* blocks;
+    // Index just past the block ptr points into, zero before the first alloc.
+    size_t next_block;
+    u32 flags;
+    // Allocation tracking tag for the arena's blocks.
+    u8 tag;
 }arena;
 
+typedef struct
+{
+    char* ptr;
+    size_t next_block;
+} arena_marker;
+
 #define ARENA_ALIGNMENT 8
-#define ARENA_BLOCK_SIZE 1024
+#define ARENA_MIN_BLOCK_SIZE (4*1024)
+#define ARENA_MAX_BLOCK_SIZE (16*1024*1024)
+#define ARENA_HUGE_PAGE_SIZE (2*1024*1024)
+
+static arena_block arena_new_block(arena* arena, size_t size)
+{
+    arena_block block = {NULL, size, false};
+#if defined(__linux__)
+    if(arena->flags & (ARENA_POPULATE | ARENA_HUGE_PAGES))
+    {
+        block.size = ALIGN_UP(size, (size_t)sysconf(_SC_PAGESIZE));
+        int populate = arena->flags & ARENA_POPULATE ? MAP_POPULATE : 0;
+        void* map = mmap(NULL, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+        if(map != MAP_FAILED)
+        {
+            if((arena->flags & ARENA_HUGE_PAGES) && block.size >= ARENA_HUGE_PAGE_SIZE)
+            {
+                madvise(map, block.size, MADV_HUGEPAGE);
+            }
+            block.base = map;
+            block.mapped = true;
+            return block;
+        }
+        block.size = size;
+    }
+#endif
+    block.base = malloc(size);
+    assert(block.base == ALIGN_DOWN_PTR(block.base, ARENA_ALIGNMENT));
+    return block;
+}
 
 void arena_grow(arena* arena, size_t min_size)
 {
-    size_t size = ALIGN_UP(MAX(ARENA_BLOCK_SIZE, min_size), ARENA_ALIGNMENT);
-    arena->ptr = malloc(size);
-    assert(arena->ptr == ALIGN_DOWN_PTR(arena->ptr, ARENA_ALIGNMENT));
-    arena->end = arena->ptr + size;
-    buf_push(arena->blocks, arena->ptr);
+    mem_track_waste(arena->tag, arena->end - arena->ptr);
+    // Reuse the blocks kept from before a reset or rewind first.
+    while(arena->next_block < buf_len(arena->blocks))
+    {
+        arena_block* block = &arena->blocks[arena->next_block++];
+        if(block->size >= min_size)
+        {
+            arena->ptr = block->base;
+            arena->end = block->base + block->size;
+            return;
+        }
+    }
+    size_t size = ARENA_MIN_BLOCK_SIZE;
+    if(arena->blocks)
+    {
+        size = CLAMP_MAX(2*arena->blocks[buf_len(arena->blocks) - 1].size, ARENA_MAX_BLOCK_SIZE);
+    }
+    size = ALIGN_UP(MAX(size, min_size), ARENA_ALIGNMENT);
+    arena_block block = arena_new_block(arena, size);
+    // Blocks of every arena are tracked here, told apart by the arena's tag.
+    mem_track_alloc(arena->tag, block.size);
+    buf_push(arena->blocks, block);
+    arena->next_block = buf_len(arena->blocks);
+    arena->ptr = block.base;
+    arena->end = block.base + block.size;
 }
 
 void *arena_alloc(arena* arena, size_t size)
@@ -180,23 +542,217 @@ void *arena_alloc(arena* arena, size_t size)
     return ptr;
 }
 
-void syntax_error(const char* fmt, ...)
+arena_marker arena_mark(arena* arena)
 {
-    va_list args;
-    va_start(args, fmt);
-    printf("Syntax Error: ");
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
+    return (arena_marker){arena->ptr, arena->next_block};
 }
 
-void fatal_syntax_error(const char* fmt, ...)
+// Frees everything allocated since the marker was taken.
+void arena_rewind(arena* arena, arena_marker marker)
 {
-    va_list args;
-    va_start(args, fmt);
-    printf("Syntax Error: ");
-    vprintf(fmt, args);
-    printf("\n");
-    va_end(args);
-    exit(1);
+    arena->next_block = marker.next_block;
+    arena->ptr = marker.ptr;
+    arena->end = marker.ptr ? arena->blocks[marker.next_block - 1].base + arena->blocks[marker.next_block - 1].size : NULL;
+}
+
+// Frees everything in the arena but keeps its blocks for reuse.
+void arena_reset(arena* arena)
+{
+    arena_rewind(arena, (arena_marker){0});
+}
+
+void arena_free(arena* arena)
+{
+    for(size_t i = 0; i < buf_len(arena->blocks); i++)
+    {
+        arena_block* block = &arena->blocks[i];
+        mem_track_free(arena->tag, block->size);
+#ifndef _WIN32
+        if(block->mapped)
+        {
+            munmap(block->base, block->size);
+            continue;
+        }
+#endif
+        free(block->base);
+    }
+    buf_free(arena->blocks);
+    arena->ptr = arena->end = NULL;
+    arena->next_block = 0;
+}
+
+// Bytes held by the arena's blocks, used or not.
+size_t arena_size(arena* arena)
+{
+    size_t size = 0;
+    for(size_t i = 0; i < buf_len(arena->blocks); i++)
+    {
+        size += arena->blocks[i].size;
+    }
+    return size;
+}
+
+// Interned strings live in an open-addressed table keyed by hash and length,
+// with the bytes themselves packed into arena blocks. Equal strings always
+// intern to the same pointer, so names can be compared with ==. Every string
+// also gets a small sequential id stored just in front of its bytes; the
+// lexer seeds the keywords first so they occupy ids [0, NUM_KEYWORDS).
+
+u64 hash_mix(u64 x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+u64 hash_bytes(const void* ptr, size_t len)
+{
+    const u8* p = ptr;
+    u64 h = 0x9e3779b97f4a7c15ull ^ len;
+    while(len >= 8)
+    {
+        u64 w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0x100000001b3ull;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+    u64 w = 0;
+    memcpy(&w, p, len);
+    h = (h ^ w) * 0x100000001b3ull;
+    return hash_mix(h);
+}
+
+typedef struct
+{
+    u64 hash;
+    u32 len;
+    const char* str;
+} intern;
+
+typedef struct
+{
+    u32 id;
+    u32 len;
+    char str[];
+} intern_str;
+
+#define intern__hdr(s) ((intern_str *)((char *)(s) - offsetof(intern_str, str)))
+
+u32 intern_id(const char* str)
+{
+    return intern__hdr(str)->id;
 }
+
+u32 intern_len(const char* str)
+{
+    return intern__hdr(str)->len;
+}
+
+typedef struct
+{
+    intern* entries;
+    size_t len;
+    size_t cap;
+    arena arena;
+    pthread_mutex_t lock;
+} intern_table;
+
+static intern_table interns = {.arena.tag = MEM_INTERN, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// The table is shared by every thread and guarded by interns.lock. Each thread
+// keeps a small direct-mapped cache of strings it has already resolved, so
+// the common case of seeing the same identifier again never takes the lock.
+#define INTERN_CACHE_SIZE 1024
+
+static _Thread_local const char* intern_cache[INTERN_CACHE_SIZE];
+
+// Counted per thread for --stats, so counting never contends.
+_Thread_local u64 intern_lookups;
+_Thread_local u64 intern_cache_hits;
+
+#define INTERN_MIN_CAP 1024
+
+static void intern_grow()
+{
+    size_t new_cap = CLAMP_MIN(2*interns.cap, INTERN_MIN_CAP);
+    intern* new_entries = calloc(new_cap, sizeof(intern));
+    mem_track_alloc(MEM_INTERN, new_cap*sizeof(intern));
+    for(size_t i = 0; i < interns.cap; i++)
+    {
+        intern* it = &interns.entries[i];
+        if(!it->str)
+        {
+            continue;
+        }
+        size_t j = it->hash & (new_cap - 1);
+        while(new_entries[j].str)
+        {
+            j = (j + 1) & (new_cap - 1);
+        }
+        new_entries[j] = *it;
+    }
+    free(interns.entries);
+    mem_track_free(MEM_INTERN, interns.cap*sizeof(intern));
+    interns.entries = new_entries;
+    interns.cap = new_cap;
+}
+
+static const char* intern_locked(const char* start, size_t len, u64 hash)
+{
+    if(2*interns.len >= interns.cap)
+    {
+        intern_grow();
+    }
+    size_t i = hash & (interns.cap - 1);
+    for(;;)
+    {
+        intern* it = &interns.entries[i];
+        if(!it->str)
+        {
+            intern_str* s = arena_alloc(&interns.arena, offsetof(intern_str, str) + len + 1);
+            s->id = (u32)interns.len;
+            s->len = (u32)len;
+            memcpy(s->str, start, len);
+            s->str[len] = 0;
+            *it = (intern){hash, (u32)len, s->str};
+            interns.len++;
+            return s->str;
+        }
+        if(it->hash == hash && it->len == len && memcmp(it->str, start, len) == 0)
+        {
+            return it->str;
+        }
+        i = (i + 1) & (interns.cap - 1);
+    }
+}
+
+const char* str_intern_range(const char* start, const char* end)
+{
+    size_t len = end - start;
+    assert(len <= UINT32_MAX);
+    u64 hash = hash_bytes(start, len);
+    const char** cached = &intern_cache[hash & (INTERN_CACHE_SIZE - 1)];
+    intern_lookups++;
+    if(*cached && intern_len(*cached) == len && memcmp(*cached, start, len) == 0)
+    {
+        intern_cache_hits++;
+        return *cached;
+    }
+    pthread_mutex_lock(&interns.lock);
+    const char* str = intern_locked(start, len, hash);
+    pthread_mutex_unlock(&interns.lock);
+    *cached = str;
+    return str;
+}
+
+const char* str_intern(const char* str)
+{
+    return str_intern_range(str, str + strlen(str));
+}
+
+_Thread_local int error_count;
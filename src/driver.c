@@ -0,0 +1,400 @@
+// Command line driver. `uct parse` lexes and parses every input file on a
+// pool of worker threads and merges the declarations in input order. `uct
+// check` then resolves the names of the merged package and type checks it.
+
+#undef MEM_TAG
+#define MEM_TAG MEM_DRIVER
+
+typedef struct
+{
+    const char* path;
+    source_file source;
+    token_buffer tokens;
+    decl** decls;
+    diagnostic* diagnostics;
+    int num_errors;
+} parsed_file;
+
+// One deque per worker. The owner pops from the tail, idle workers steal from
+// the head, so a worker that drew a run of small files helps with the rest.
+typedef struct
+{
+    pthread_mutex_t lock;
+    u32* items;
+    u32 head;
+    u32 tail;
+} work_queue;
+
+typedef struct
+{
+    parsed_file* files;
+    work_queue* queues;
+    int num_workers;
+} parse_job;
+
+typedef struct
+{
+    parse_job* job;
+    int index;
+} parse_worker;
+
+bool work_pop(work_queue* queue, u32* item)
+{
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->head < queue->tail)
+    {
+        *item = queue->items[--queue->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+bool work_steal(work_queue* queue, u32* item)
+{
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->head < queue->tail)
+    {
+        *item = queue->items[queue->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+void parse_file(parsed_file* file)
+{
+    stats_timer timer = stats_start();
+    bool loaded = source_load(&file->source, file->path);
+    stats_stop(PHASE_READ, timer);
+    if(!loaded)
+    {
+        file->num_errors++;
+        return;
+    }
+    thread_stats.files++;
+    thread_stats.bytes += file->source.len;
+    // Skipped bodies can't be cached, so lazy runs always parse.
+    bool use_cache = ast_cache_dir && !parse_lazy_bodies;
+    timer = stats_start();
+    u64 source_hash = use_cache ? hash_bytes(file->source.text, file->source.len) : 0;
+    bool cached = use_cache && ast_cache_load(&file->decls, file->path, file->source.text, file->source.len, source_hash);
+    stats_stop(PHASE_CACHE, timer);
+    if(cached)
+    {
+        if(stats_mode)
+        {
+            stats_count_decls(file->decls, buf_len(file->decls));
+        }
+        return;
+    }
+    // Lazily parsed bodies refer back to the file's tokens, so those are kept
+    // alive instead of reusing the thread's buffer. The source itself always
+    // stays mapped: the source map builds line tables from it on demand.
+    token_buffer* tokens = parse_lazy_bodies ? &file->tokens : &lex_tokens;
+    error_count = 0;
+    timer = stats_start();
+    tokenize_file(tokens, file->path, file->source.text);
+    stats_stop(PHASE_LEX, timer);
+    timer = stats_start();
+    init_parse_tokens(tokens);
+    while(!is_token_eof() && !error_limit_reached())
+    {
+        decl* decl = parse_decl();
+        if(decl)
+        {
+            buf_push(file->decls, decl);
+        }
+    }
+    stats_stop(PHASE_PARSE, timer);
+    if(stats_mode)
+    {
+        stats_count_tokens(tokens);
+        stats_count_decls(file->decls, buf_len(file->decls));
+    }
+    file->num_errors += error_count;
+    file->diagnostics = diagnostics;
+    diagnostics = NULL;
+    if(use_cache && !error_count)
+    {
+        timer = stats_start();
+        ast_cache_store(source_hash, file->source.len, tokens->base, file->decls, buf_len(file->decls));
+        stats_stop(PHASE_CACHE, timer);
+    }
+}
+
+void* parse_worker_main(void* arg)
+{
+    parse_worker* worker = arg;
+    parse_job* job = worker->job;
+    u32 item;
+    for(;;)
+    {
+        if(work_pop(&job->queues[worker->index], &item))
+        {
+            parse_file(&job->files[item]);
+            continue;
+        }
+        bool stole = false;
+        for(int i = 1; i < job->num_workers && !stole; i++)
+        {
+            work_queue* victim = &job->queues[(worker->index + i) % job->num_workers];
+            if(work_steal(victim, &item))
+            {
+                parse_file(&job->files[item]);
+                stole = true;
+            }
+        }
+        // Nothing new is ever queued, so once every deque is empty we're done.
+        if(!stole)
+        {
+            break;
+        }
+    }
+    token_buffer_free(&lex_tokens);
+    buf_free(parse_scratch);
+    stats_flush_thread();
+    return NULL;
+}
+
+void parse_files(parsed_file* files, size_t num_files, int num_workers)
+{
+    num_workers = (int)CLAMP_MAX((size_t)num_workers, num_files);
+    num_workers = CLAMP_MIN(num_workers, 1);
+    parse_job job = {files, calloc(num_workers, sizeof(work_queue)), num_workers};
+    parse_worker* workers = calloc(num_workers, sizeof(parse_worker));
+    pthread_t* threads = calloc(num_workers, sizeof(pthread_t));
+    size_t job_size = num_workers*(sizeof(work_queue) + sizeof(parse_worker) + sizeof(pthread_t));
+    mem_track_alloc(MEM_DRIVER, job_size);
+    for(int i = 0; i < num_workers; i++)
+    {
+        work_queue* queue = &job.queues[i];
+        pthread_mutex_init(&queue->lock, NULL);
+        for(size_t j = num_files*i/num_workers; j < num_files*(i + 1)/num_workers; j++)
+        {
+            buf_push(queue->items, (u32)j);
+        }
+        queue->tail = buf_len(queue->items);
+        workers[i] = (parse_worker){&job, i};
+    }
+    for(int i = 1; i < num_workers; i++)
+    {
+        pthread_create(&threads[i], NULL, parse_worker_main, &workers[i]);
+    }
+    parse_worker_main(&workers[0]);
+    for(int i = 1; i < num_workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    for(int i = 0; i < num_workers; i++)
+    {
+        pthread_mutex_destroy(&job.queues[i].lock);
+        buf_free(job.queues[i].items);
+    }
+    free(job.queues);
+    free(workers);
+    free(threads);
+    mem_track_free(MEM_DRIVER, job_size);
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+static bool has_extension(const char* path, const char* ext)
+{
+    size_t len = strlen(path);
+    size_t ext_len = strlen(ext);
+    return len > ext_len && strcmp(path + len - ext_len, ext) == 0;
+}
+
+// Adds path to paths, or every .uct file in it if it's a directory. Directory
+// entries are sorted so the merged result doesn't depend on readdir order.
+bool collect_sources(const char*** paths, const char* path)
+{
+    struct stat st;
+    if(stat(path, &st) != 0)
+    {
+        printf("error: File not found: %s\n", path);
+        return false;
+    }
+    if(!S_ISDIR(st.st_mode))
+    {
+        buf_push(*paths, path);
+        return true;
+    }
+    DIR* dir = opendir(path);
+    if(!dir)
+    {
+        printf("error: Cannot open directory: %s\n", path);
+        return false;
+    }
+    const char** found = NULL;
+    struct dirent* entry;
+    while((entry = readdir(dir)))
+    {
+        if(entry->d_name[0] != '.' && has_extension(entry->d_name, ".uct"))
+        {
+            char* file_path = NULL;
+            buf_printf(file_path, "%s/%s", path, entry->d_name);
+            buf_push(found, file_path);
+        }
+    }
+    closedir(dir);
+    qsort(found, buf_len(found), sizeof(*found), compare_paths);
+    for(size_t i = 0; i < buf_len(found); i++)
+    {
+        buf_push(*paths, found[i]);
+    }
+    buf_free(found);
+    return true;
+}
+
+// Prints diagnostics in order until error_limit errors have been shown and
+// counts the errors past it in num_hidden.
+void print_diagnostics(diagnostic* diags, int* num_reported, int* num_hidden)
+{
+    for(size_t i = 0; i < buf_len(diags); i++)
+    {
+        diagnostic* diag = &diags[i];
+        if(error_limit && *num_reported >= error_limit)
+        {
+            *num_hidden += diag->level == DIAGNOSTIC_ERROR;
+            continue;
+        }
+        print_diagnostic(diag);
+        *num_reported += diag->level == DIAGNOSTIC_ERROR;
+    }
+}
+
+void print_parse_usage()
+{
+    printf("usage: uct parse|check [-j threads] [-v] [--lazy] [--error-limit n] [--cache dir] [--stats[=json]] <file.uct|directory>...\n");
+}
+
+// check resolves names and checks types once the package is parsed. That's
+// skipped when there were syntax errors, since recovered code mostly produces
+// follow-on errors.
+int parse_main(int argc, char** argv, bool check)
+{
+    int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool verbose = false;
+    const char** paths = NULL;
+    bool ok = true;
+    for(int i = 0; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            num_workers = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-v") == 0)
+        {
+            verbose = true;
+        }
+        else if(strcmp(argv[i], "--lazy") == 0)
+        {
+            parse_lazy_bodies = true;
+        }
+        else if(strcmp(argv[i], "--error-limit") == 0 && i + 1 < argc)
+        {
+            error_limit = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            ast_cache_dir = argv[++i];
+            mkdir(ast_cache_dir, 0777);
+        }
+        else if(strcmp(argv[i], "--stats") == 0)
+        {
+            stats_mode = STATS_TEXT;
+        }
+        else if(strcmp(argv[i], "--stats=json") == 0)
+        {
+            stats_mode = STATS_JSON;
+        }
+        else if(argv[i][0] == '-')
+        {
+            print_parse_usage();
+            return 1;
+        }
+        else
+        {
+            ok &= collect_sources(&paths, argv[i]);
+        }
+    }
+    if(!ok)
+    {
+        return 1;
+    }
+    if(!paths)
+    {
+        print_parse_usage();
+        return 1;
+    }
+
+    size_t num_files = buf_len(paths);
+    parsed_file* files = calloc(num_files, sizeof(parsed_file));
+    mem_track_alloc(MEM_DRIVER, num_files*sizeof(parsed_file));
+    for(size_t i = 0; i < num_files; i++)
+    {
+        files[i].path = paths[i];
+    }
+    double start_time = clock_seconds(CLOCK_MONOTONIC);
+    parse_files(files, num_files, num_workers);
+    double wall_time = clock_seconds(CLOCK_MONOTONIC) - start_time;
+
+    decl** package = NULL;
+    int num_errors = 0;
+    int num_reported = 0;
+    int num_hidden = 0;
+    for(size_t i = 0; i < num_files; i++)
+    {
+        print_diagnostics(files[i].diagnostics, &num_reported, &num_hidden);
+        diagnostics_free(&files[i].diagnostics);
+        for(size_t j = 0; j < buf_len(files[i].decls); j++)
+        {
+            buf_push(package, files[i].decls[j]);
+        }
+        num_errors += files[i].num_errors;
+        if(verbose)
+        {
+            printf("%s: %zu decls\n", files[i].path, buf_len(files[i].decls));
+        }
+    }
+    if(check && !num_errors)
+    {
+        // Lazily skipped bodies are parsed here, on this thread.
+        error_count = 0;
+        stats_timer timer = stats_start();
+        resolve_package(package, buf_len(package));
+        stats_stop(PHASE_RESOLVE, timer);
+        stats_flush_phase(PHASE_RESOLVE);
+        timer = stats_start();
+        check_package(package, buf_len(package));
+        stats_stop(PHASE_CHECK, timer);
+        stats_flush_phase(PHASE_CHECK);
+        print_diagnostics(diagnostics, &num_reported, &num_hidden);
+        diagnostics_free(&diagnostics);
+        num_errors += error_count;
+    }
+    if(verbose)
+    {
+        for(size_t i = 0; i < buf_len(package); i++)
+        {
+            printf("    %s %s\n", decl_type_names[package[i]->type], package[i]->name);
+        }
+    }
+    if(num_hidden)
+    {
+        printf("error: too many errors, %d more not shown\n", num_hidden);
+    }
+    printf("%zu files, %zu decls, %d errors\n", num_files, buf_len(package), num_errors);
+    if(stats_mode)
+    {
+        stats_print(wall_time);
+    }
+    return num_errors ? 1 : 0;
+}
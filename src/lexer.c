@@ -1,22 +1,24 @@
 #include "lexer.h"
 
+#undef MEM_TAG
+#define MEM_TAG MEM_LEXER
+
 typedef struct
 {
+    const char* path;
     const char* start;
     const char* current;
-    i32 line;
+    u32 base;
 } lexer;
 
-lexer lex;
-token tok;
+// Lexer and parser state is per thread so several files can be lexed and
+// parsed at once; the interner is the only shared structure.
+_Thread_local lexer lex;
+_Thread_local token tok;
 
+// String literals are decoded straight into the AST arena (see ast.c).
+extern _Thread_local arena ast_arena;
 
-static bool is_alpha(char c)
-{
-    return  (c >= 'a' && c <= 'z') ||
-            (c >= 'A' && c <= 'Z') ||
-            c == '_';
-}
 
 u8 char_to_digit[256] =
 {
@@ -38,9 +40,259 @@ u8 char_to_digit[256] =
     ['f'] = 15, ['F'] = 15,
 };
 
+// Character classes for the lexer's hot loops. The scalar kernels below read
+// this table directly; the SSE2/AVX2 kernels test the same classes with range
+// compares on 16 or 32 bytes at a time and fall back to the table for nothing
+// but the final partial block. '\0' belongs to no class, so every kernel stops
+// on the source terminator.
+enum
+{
+    CHAR_SPACE = 1 << 0,
+    CHAR_NEWLINE = 1 << 1,
+    CHAR_DIGIT = 1 << 2,
+    CHAR_IDENT = 1 << 3,
+    CHAR_HEX = 1 << 4,
+};
+
+static const u8 char_class[256] =
+{
+    [' '] = CHAR_SPACE,
+    ['\t'] = CHAR_SPACE,
+    ['\n'] = CHAR_SPACE | CHAR_NEWLINE,
+    ['\v'] = CHAR_SPACE,
+    ['\f'] = CHAR_SPACE,
+    ['\r'] = CHAR_SPACE,
+    ['0' ... '9'] = CHAR_DIGIT | CHAR_IDENT | CHAR_HEX,
+    ['a' ... 'f'] = CHAR_IDENT | CHAR_HEX,
+    ['g' ... 'z'] = CHAR_IDENT,
+    ['A' ... 'F'] = CHAR_IDENT | CHAR_HEX,
+    ['G' ... 'Z'] = CHAR_IDENT,
+    ['_'] = CHAR_IDENT,
+};
+
+#define is_char_class(c, class) (char_class[(u8)(c)] & (class))
+
 static bool is_digit(char c)
 {
-    return c >= '0' && c <= '9';
+    return is_char_class(c, CHAR_DIGIT);
+}
+
+static const char* skip_space_scalar(const char* p)
+{
+    while(is_char_class(*p, CHAR_SPACE))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_ident_scalar(const char* p)
+{
+    while(is_char_class(*p, CHAR_IDENT))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_digits_scalar(const char* p)
+{
+    while(is_char_class(*p, CHAR_DIGIT))
+    {
+        p++;
+    }
+    return p;
+}
+
+static const char* skip_line_scalar(const char* p)
+{
+    while(*p && *p != '\n')
+    {
+        p++;
+    }
+    return p;
+}
+
+// The vector and SWAR scans read past the terminating '\0' without leaving
+// its page, which AddressSanitizer can't tell from a real overflow.
+#if defined(__GNUC__) || defined(__clang__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LEX_SIMD_X86 1
+
+// The vector kernels only ever load whole aligned blocks. A block that holds
+// the terminating '\0' never crosses a page boundary, so reading the rest of
+// it is safe even though it runs past the end of the source string.
+
+#define SSE2_IN_RANGE(v, lo, hi) \
+    _mm_cmplt_epi8(_mm_add_epi8((v), _mm_set1_epi8((char)(-128 - (lo)))), _mm_set1_epi8((char)(-128 + (hi) - (lo) + 1)))
+
+#define AVX2_IN_RANGE(v, lo, hi) \
+    _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + (hi) - (lo) + 1)), _mm256_add_epi8((v), _mm256_set1_epi8((char)(-128 - (lo)))))
+
+__attribute__((target("sse2")))
+static u32 space_mask_sse2(__m128i v)
+{
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), SSE2_IN_RANGE(v, '\t', '\r'));
+    return (u32)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static u32 ident_mask_sse2(__m128i v)
+{
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i m = _mm_or_si128(SSE2_IN_RANGE(lower, 'a', 'z'), SSE2_IN_RANGE(v, '0', '9'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    return (u32)_mm_movemask_epi8(m);
+}
+
+__attribute__((target("sse2")))
+static u32 digit_mask_sse2(__m128i v)
+{
+    return (u32)_mm_movemask_epi8(SSE2_IN_RANGE(v, '0', '9'));
+}
+
+__attribute__((target("sse2")))
+static u32 line_end_mask_sse2(__m128i v)
+{
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return (u32)_mm_movemask_epi8(m);
+}
+
+// Returns the first byte at or after p whose bit is clear in class_mask.
+#define SSE2_SKIP(name, class_mask) \
+    __attribute__((target("sse2"))) NO_SANITIZE_ADDRESS \
+    static const char* name(const char* p) \
+    { \
+        const char* block = ALIGN_DOWN_PTR(p, 16); \
+        u32 stop = ~class_mask(_mm_load_si128((const __m128i*)block)) & (0xFFFFu << (p - block)) & 0xFFFF; \
+        while(!stop) \
+        { \
+            block += 16; \
+            stop = ~class_mask(_mm_load_si128((const __m128i*)block)) & 0xFFFF; \
+        } \
+        return block + __builtin_ctz(stop); \
+    }
+
+SSE2_SKIP(skip_space_sse2, space_mask_sse2)
+SSE2_SKIP(skip_ident_sse2, ident_mask_sse2)
+SSE2_SKIP(skip_digits_sse2, digit_mask_sse2)
+
+__attribute__((target("sse2"))) NO_SANITIZE_ADDRESS
+static const char* skip_line_sse2(const char* p)
+{
+    const char* block = ALIGN_DOWN_PTR(p, 16);
+    u32 stop = line_end_mask_sse2(_mm_load_si128((const __m128i*)block)) & (0xFFFFu << (p - block));
+    while(!stop)
+    {
+        block += 16;
+        stop = line_end_mask_sse2(_mm_load_si128((const __m128i*)block));
+    }
+    return block + __builtin_ctz(stop);
+}
+
+__attribute__((target("avx2")))
+static u32 space_mask_avx2(__m256i v)
+{
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), AVX2_IN_RANGE(v, '\t', '\r'));
+    return (u32)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static u32 ident_mask_avx2(__m256i v)
+{
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i m = _mm256_or_si256(AVX2_IN_RANGE(lower, 'a', 'z'), AVX2_IN_RANGE(v, '0', '9'));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    return (u32)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static u32 digit_mask_avx2(__m256i v)
+{
+    return (u32)_mm256_movemask_epi8(AVX2_IN_RANGE(v, '0', '9'));
+}
+
+__attribute__((target("avx2")))
+static u32 line_end_mask_avx2(__m256i v)
+{
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    return (u32)_mm256_movemask_epi8(m);
+}
+
+#define AVX2_SKIP(name, class_mask) \
+    __attribute__((target("avx2"))) NO_SANITIZE_ADDRESS \
+    static const char* name(const char* p) \
+    { \
+        const char* block = ALIGN_DOWN_PTR(p, 32); \
+        u32 stop = ~class_mask(_mm256_load_si256((const __m256i*)block)) & (0xFFFFFFFFu << (p - block)); \
+        while(!stop) \
+        { \
+            block += 32; \
+            stop = ~class_mask(_mm256_load_si256((const __m256i*)block)); \
+        } \
+        return block + __builtin_ctz(stop); \
+    }
+
+AVX2_SKIP(skip_space_avx2, space_mask_avx2)
+AVX2_SKIP(skip_ident_avx2, ident_mask_avx2)
+AVX2_SKIP(skip_digits_avx2, digit_mask_avx2)
+
+__attribute__((target("avx2"))) NO_SANITIZE_ADDRESS
+static const char* skip_line_avx2(const char* p)
+{
+    const char* block = ALIGN_DOWN_PTR(p, 32);
+    u32 stop = line_end_mask_avx2(_mm256_load_si256((const __m256i*)block)) & (0xFFFFFFFFu << (p - block));
+    while(!stop)
+    {
+        block += 32;
+        stop = line_end_mask_avx2(_mm256_load_si256((const __m256i*)block));
+    }
+    return block + __builtin_ctz(stop);
+}
+
+#undef SSE2_IN_RANGE
+#undef AVX2_IN_RANGE
+#undef SSE2_SKIP
+#undef AVX2_SKIP
+#endif
+
+typedef struct
+{
+    const char* name;
+    const char* (*skip_space)(const char* p);
+    const char* (*skip_ident)(const char* p);
+    const char* (*skip_digits)(const char* p);
+    const char* (*skip_line)(const char* p);
+} lex_kernels;
+
+const lex_kernels lex_kernels_scalar = {"scalar", skip_space_scalar, skip_ident_scalar, skip_digits_scalar, skip_line_scalar};
+#if LEX_SIMD_X86
+const lex_kernels lex_kernels_sse2 = {"sse2", skip_space_sse2, skip_ident_sse2, skip_digits_sse2, skip_line_sse2};
+const lex_kernels lex_kernels_avx2 = {"avx2", skip_space_avx2, skip_ident_avx2, skip_digits_avx2, skip_line_avx2};
+#endif
+
+lex_kernels lex_simd = {"scalar", skip_space_scalar, skip_ident_scalar, skip_digits_scalar, skip_line_scalar};
+
+// Picks the widest kernels the running CPU supports. Call once at startup.
+void init_lex_simd()
+{
+    lex_simd = lex_kernels_scalar;
+#if LEX_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        lex_simd = lex_kernels_avx2;
+    }
+    else if(__builtin_cpu_supports("sse2"))
+    {
+        lex_simd = lex_kernels_sse2;
+    }
+#endif
 }
 
 static bool is_at_end()
@@ -48,88 +300,343 @@ static bool is_at_end()
     return *lex.current == '\0';
 }
 
-void warning(const char* fmt, ...)
+// Source positions. Each file handed to the lexer gets its own range of one
+// shared u32 position space, so a single u32 names both the file and the
+// byte offset within it; tokens and AST nodes store nothing else. A file's
+// line start table is only built, with the vector newline kernel, the first
+// time a diagnostic has to turn one of its positions into a line and column.
+typedef struct
+{
+    const char* path;
+    const char* text;
+    u32 base;
+    u32 len;
+    u32* line_starts;
+} source_entry;
+
+typedef struct
+{
+    const char* path;
+    i32 line;
+    i32 col;
+} source_loc;
+
+static struct
+{
+    source_entry** entries;
+    u32 next_base;
+    pthread_mutex_t lock;
+} source_map = {.next_base = 1, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// The text must stay alive for as long as positions in it may be reported.
+u32 source_map_add(const char* path, const char* text, size_t len)
+{
+    source_entry* entry = calloc(1, sizeof(source_entry));
+    mem_track_alloc(MEM_LEXER, sizeof(source_entry));
+    pthread_mutex_lock(&source_map.lock);
+    assert(len < UINT32_MAX - source_map.next_base);
+    *entry = (source_entry){path, text, source_map.next_base, (u32)len};
+    source_map.next_base += (u32)len + 1;
+    buf_push(source_map.entries, entry);
+    pthread_mutex_unlock(&source_map.lock);
+    return entry->base;
+}
+
+static void build_line_starts(source_entry* entry)
+{
+    buf_push(entry->line_starts, 0);
+    const char* end = entry->text + entry->len;
+    for(const char* p = lex_simd.skip_line(entry->text); p < end && *p == '\n'; p = lex_simd.skip_line(p + 1))
+    {
+        buf_push(entry->line_starts, (u32)(p + 1 - entry->text));
+    }
+}
+
+source_loc source_map_lookup(u32 pos)
+{
+    source_loc loc = {"<unknown>"};
+    pthread_mutex_lock(&source_map.lock);
+    size_t lo = 0;
+    size_t hi = buf_len(source_map.entries);
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo)/2;
+        if(source_map.entries[mid]->base <= pos)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if(pos && lo > 0)
+    {
+        source_entry* entry = source_map.entries[lo - 1];
+        if(!entry->line_starts)
+        {
+            build_line_starts(entry);
+        }
+        u32 offset = pos - entry->base;
+        u32* starts = entry->line_starts;
+        size_t line_lo = 0;
+        size_t line_hi = buf_len(starts);
+        while(line_lo < line_hi)
+        {
+            size_t mid = line_lo + (line_hi - line_lo)/2;
+            if(starts[mid] <= offset)
+            {
+                line_lo = mid + 1;
+            }
+            else
+            {
+                line_hi = mid;
+            }
+        }
+        loc = (source_loc){entry->path, (i32)line_lo, (i32)(offset - starts[line_lo - 1] + 1)};
+    }
+    pthread_mutex_unlock(&source_map.lock);
+    return loc;
+}
+
+// Position of the current token, both while scanning and while parsing.
+u32 token_pos()
+{
+    return lex.base + (u32)(tok.start - lex.start);
+}
+
+typedef enum
+{
+    DIAGNOSTIC_WARNING,
+    DIAGNOSTIC_ERROR,
+} diagnostic_level;
+
+typedef struct
+{
+    u32 pos;
+    diagnostic_level level;
+    char* msg;
+} diagnostic;
+
+// Diagnostics are collected rather than printed as they're found, so that the
+// driver can report every file's errors in input order once parsing is done.
+_Thread_local diagnostic* diagnostics;
+
+// Parsing of a file stops once it has produced this many errors. Zero means
+// no limit.
+int error_limit = 20;
+
+bool error_limit_reached()
+{
+    return error_limit && error_count >= error_limit;
+}
+
+static void add_diagnostic(u32 pos, diagnostic_level level, const char* fmt, va_list args)
+{
+    va_list len_args;
+    va_copy(len_args, args);
+    int len = vsnprintf(NULL, 0, fmt, len_args);
+    va_end(len_args);
+    char* msg = malloc(len + 1);
+    mem_track_alloc(MEM_LEXER, len + 1);
+    vsnprintf(msg, len + 1, fmt, args);
+    buf_push(diagnostics, (diagnostic){pos, level, msg});
+}
+
+void print_diagnostic(diagnostic* diag)
+{
+    source_loc loc = source_map_lookup(diag->pos);
+    printf("%s(%d:%d): %s: %s\n", loc.path, loc.line, loc.col, diag->level == DIAGNOSTIC_ERROR ? "error" : "warning", diag->msg);
+}
+
+void diagnostics_free(diagnostic** diags)
+{
+    for(size_t i = 0; i < buf_len(*diags); i++)
+    {
+        mem_track_free(MEM_LEXER, strlen((*diags)[i].msg) + 1);
+        free((*diags)[i].msg);
+    }
+    buf_free(*diags);
+}
+
+void warning_at(u32 pos, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    printf("%s(%d): warning: ", tok.name, lex.line);
-    vprintf(fmt, args);
-    printf("\n");
+    add_diagnostic(pos, DIAGNOSTIC_WARNING, fmt, args);
     va_end(args);
 }
 
-void error(const char* fmt, ...)
+void error_at(u32 pos, const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    printf("%s(%d): error: ", tok.name, lex.line);
-    vprintf(fmt, args);
-    printf("\n");
+    add_diagnostic(pos, DIAGNOSTIC_ERROR, fmt, args);
     va_end(args);
+    error_count++;
 }
 
-#define fatal_error(...) (error(__VA_ARGS__), exit(1))
+#define warning(...) warning_at(token_pos(), __VA_ARGS__)
+#define error(...) error_at(token_pos(), __VA_ARGS__)
+
+// A syntax error puts the parser into panic mode until it resynchronizes on a
+// statement or declaration boundary. Anything reported in the meantime is
+// almost always fallout from the first error, so it's dropped.
+_Thread_local bool parse_panic;
 
-void scan_int()
+void syntax_error(const char* fmt, ...)
 {
-    tok.start = lex.current;
-    i32 base = 10;
-    const char *start_digits = lex.current;
-    if(*lex.current == '0')
+    if(!parse_panic)
     {
-        lex.current++;
-        if(tolower(*lex.current) == 'x')
-        {
-            lex.current++;
-            tok.mod = MOD_HEX;
-            base = 16;
-            start_digits = lex.current;
-        }
-        else if(tolower(*lex.current) == 'b')
-        {
-            lex.current++;
-            tok.mod = MOD_BIN;
-            base = 2;
-            start_digits = lex.current;
-        }
-        else if(tolower(*lex.current) == 'o')
-        {
-            lex.current++;
-            tok.mod = MOD_OCT;
-            base = 8;
-            start_digits = lex.current;
-        }
+        va_list args;
+        va_start(args, fmt);
+        add_diagnostic(token_pos(), DIAGNOSTIC_ERROR, fmt, args);
+        va_end(args);
+        error_count++;
+        parse_panic = true;
     }
-    unsigned long long val = 0;
+}
+
+// Number literals are scanned in one pass. Decimal digits accumulate into a
+// u64 mantissa, and a '.' or exponent switches the same scan over to a float
+// without going back over the digits. Runs of 8 decimal, hex or binary digits
+// are validated and converted with SWAR arithmetic on a single 64-bit load.
+// Like the vector kernels, the load is only done when it can't cross into the
+// next page, so it never faults past the end of the source.
+#define CAN_LOAD8(p) (((uintptr_t)(p) & 4095) <= 4096 - 8)
+
+NO_SANITIZE_ADDRESS
+static u64 load8(const char* p)
+{
+    u64 v;
+    __builtin_memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static bool is_eight_digits(u64 v)
+{
+    return (((v & 0xF0F0F0F0F0F0F0F0ull) | (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull);
+}
+
+static u32 parse_eight_digits(u64 v)
+{
+    v -= 0x3030303030303030ull;
+    v = (v*10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFull)*(100 + (1000000ull << 32))) + (((v >> 16) & 0x000000FF000000FFull)*(1 + (10000ull << 32)))) >> 32;
+    return (u32)v;
+}
+
+NO_SANITIZE_ADDRESS
+static bool is_eight_hex_digits(const char* p)
+{
+    u8 all = CHAR_HEX;
+    for(int i = 0; i < 8; i++)
+    {
+        all &= char_class[(u8)p[i]];
+    }
+    return all;
+}
+
+static u32 parse_eight_hex_digits(u64 v)
+{
+    // Letters have bit 6 set and need 9 added to their low nibble.
+    v = (v & 0x0F0F0F0F0F0F0F0Full) + ((v >> 6) & 0x0101010101010101ull)*9;
+    v = __builtin_bswap64(v);
+    v = (v | (v >> 4)) & 0x00FF00FF00FF00FFull;
+    v = (v | (v >> 8)) & 0x0000FFFF0000FFFFull;
+    v = (v | (v >> 16)) & 0x00000000FFFFFFFFull;
+    return (u32)v;
+}
+
+static bool is_eight_bin_digits(u64 v)
+{
+    return (v & 0xFEFEFEFEFEFEFEFEull) == 0x3030303030303030ull;
+}
+
+static u32 parse_eight_bin_digits(u64 v)
+{
+    return (u32)(((v & 0x0101010101010101ull)*0x8040201008040201ull) >> 56);
+}
+
+// Scans digits in base into *val, skipping '_' separators. Returns false on
+// overflow, leaving lex.current after the remaining digits.
+static bool scan_digits(i32 base, u64* val)
+{
+    const char* p = lex.current;
+    u64 v = *val;
     for(;;)
     {
-        if(*lex.current == '_')
+        if(CAN_LOAD8(p))
         {
-            lex.current++;
+            if(base == 10 && v <= 99999999999ull && is_eight_digits(load8(p)))
+            {
+                v = v*100000000 + parse_eight_digits(load8(p));
+                p += 8;
+                continue;
+            }
+            if(base == 16 && v <= 0xFFFFFFFFull && is_eight_hex_digits(p))
+            {
+                v = (v << 32) | parse_eight_hex_digits(load8(p));
+                p += 8;
+                continue;
+            }
+            if(base == 2 && v <= 0x00FFFFFFFFFFFFFFull && is_eight_bin_digits(load8(p)))
+            {
+                v = (v << 8) | parse_eight_bin_digits(load8(p));
+                p += 8;
+                continue;
+            }
+        }
+        if(*p == '_')
+        {
+            p++;
             continue;
         }
-        i32 digit = char_to_digit[(unsigned char)*lex.current];
-        if(digit == 0 && *lex.current != '0')
+        if(!is_char_class(*p, CHAR_HEX))
         {
             break;
         }
+        i32 digit = char_to_digit[(u8)*p];
         if(digit >= base)
         {
-            error("Digit '%c' too high for base %d", *lex.current, base);
+            // Letters past the base end the number; they start a suffix,
+            // exponent or the next token.
+            if(!is_digit(*p))
+            {
+                break;
+            }
+            error("Digit '%c' too high for base %d", *p, base);
             digit = 0;
         }
-        if(val > (ULLONG_MAX - digit)/base)
+        if(v > (ULLONG_MAX - digit)/base)
         {
-            error("overflow");
-            while(isdigit(*lex.current))
+            u8 class = base == 16 ? CHAR_HEX : CHAR_DIGIT;
+            while(is_char_class(*p, class) || *p == '_')
             {
-                lex.current++;
+                p++;
             }
-            val = 0;
-            break;
+            lex.current = p;
+            return false;
         }
-        val = val*base + digit;
-        lex.current++;
+        v = v*base + digit;
+        p++;
+    }
+    lex.current = p;
+    *val = v;
+    return true;
+}
+
+void scan_int(i32 base)
+{
+    const char* start_digits = lex.current;
+    u64 val = 0;
+    if(!scan_digits(base, &val))
+    {
+        error("overflow");
+        val = 0;
     }
     if(lex.current == start_digits)
     {
@@ -137,34 +644,140 @@ void scan_int()
     }
     tok.type = TOKEN_INT;
     tok.int_val = val;
-    tok.line = lex.line;
 }
 
-void scan_float()
+// Slow path for floats the fast path can't round exactly. The literal is
+// copied without separators so strtod sees exactly what we scanned; uct never
+// calls setlocale, so strtod runs in the "C" locale.
+static f64 scan_float_slow(const char* start, const char* end)
 {
-    const char *start = lex.current;
-    while(isdigit(*lex.current))
+    char small[64];
+    size_t size = end - start + 1;
+    char* text = size <= sizeof(small) ? small : malloc(size);
+    size_t len = 0;
+    for(const char* p = start; p < end; p++)
     {
-        lex.current++;
+        if(*p != '_')
+        {
+            text[len++] = *p;
+        }
     }
+    text[len] = 0;
+    f64 val = strtod(text, NULL);
+    if(text != small)
+    {
+        mem_track_alloc(MEM_LEXER, size);
+        mem_track_free(MEM_LEXER, size);
+        free(text);
+    }
+    return val;
+}
+
+static const f64 exact_powers_of_ten[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Finishes a decimal literal whose integer digits are already in mantissa.
+// When the mantissa fits in 53 bits and the power of ten is exact, a single
+// multiply or divide is correctly rounded (Clinger's fast path), which covers
+// nearly every literal written by hand or by table generators.
+void scan_float(const char* start, u64 mantissa, bool exact)
+{
+    i32 exp10 = 0;
     if(*lex.current == '.')
     {
         lex.current++;
+        for(; is_digit(*lex.current) || *lex.current == '_'; lex.current++)
+        {
+            if(*lex.current == '_')
+            {
+                continue;
+            }
+            if(exact && mantissa <= (ULLONG_MAX - 9)/10)
+            {
+                mantissa = mantissa*10 + (*lex.current - '0');
+                exp10--;
+            }
+            else
+            {
+                exact = false;
+            }
+        }
     }
-    while(isdigit(*lex.current))
+    if(tolower(*lex.current) == 'e')
     {
-        lex.current++;
+        const char* p = lex.current + 1;
+        bool neg = *p == '-';
+        if(*p == '+' || *p == '-')
+        {
+            p++;
+        }
+        if(is_digit(*p))
+        {
+            i32 exp = 0;
+            for(; is_digit(*p); p++)
+            {
+                exp = exp < 100000 ? exp*10 + (*p - '0') : exp;
+            }
+            exp10 += neg ? -exp : exp;
+            lex.current = p;
+        }
+    }
+    f64 val;
+#if FLT_EVAL_METHOD == 0
+    if(exact && mantissa <= (1ull << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+        val = exp10 < 0 ? (f64)mantissa / exact_powers_of_ten[-exp10] : (f64)mantissa * exact_powers_of_ten[exp10];
+    }
+    else
+#endif
+    {
+        val = scan_float_slow(start, lex.current);
     }
-    f64 val = strtod(start, NULL);
     if(val == HUGE_VAL)
     {
         error("Float literal overflow");
     }
     tok.type = TOKEN_FLOAT;
     tok.float_val = val;
-    tok.line = lex.line;
 }
 
+void scan_number()
+{
+    tok.start = lex.current;
+    if(*lex.current == '0')
+    {
+        char prefix = tolower(lex.current[1]);
+        i32 base = prefix == 'x' ? 16 : prefix == 'b' ? 2 : prefix == 'o' ? 8 : 0;
+        if(base)
+        {
+            tok.mod = base == 16 ? MOD_HEX : base == 2 ? MOD_BIN : MOD_OCT;
+            lex.current += 2;
+            scan_int(base);
+            return;
+        }
+    }
+    u64 val = 0;
+    bool exact = scan_digits(10, &val);
+    char c = *lex.current;
+    if(c == '.' || ((c == 'e' || c == 'E') && (is_digit(lex.current[1]) || ((lex.current[1] == '+' || lex.current[1] == '-') && is_digit(lex.current[2])))))
+    {
+        scan_float(tok.start, val, exact);
+        return;
+    }
+    if(!exact)
+    {
+        error("overflow");
+        val = 0;
+    }
+    tok.type = TOKEN_INT;
+    tok.int_val = val;
+}
+
+#undef CAN_LOAD8
+
 char escape_to_char[256] =
 {
     ['0'] = '\0',
@@ -179,6 +792,21 @@ char escape_to_char[256] =
     ['a'] = '\a',
 };
 
+// Decodes the escape after a backslash, leaving lex.current past it.
+static char scan_escape()
+{
+    char c = escape_to_char[(u8)*lex.current];
+    if(c == 0 && *lex.current != '0')
+    {
+        error("Invalid escape '\\%c'", *lex.current);
+    }
+    if(*lex.current)
+    {
+        lex.current++;
+    }
+    return c;
+}
+
 void scan_char()
 {
     assert(*lex.current == '\'');
@@ -196,12 +824,7 @@ void scan_char()
     else if(*lex.current == '\\')
     {
         lex.current++;
-        val = escape_to_char[(unsigned char)*lex.current];
-        if(val == 0 && *lex.current != '0')
-        {
-            error("Invalid char literal escape '\\%c'", *lex.current);
-        }
-        lex.current++;
+        val = scan_escape();
     }
     else
     {
@@ -221,37 +844,71 @@ void scan_char()
     tok.mod = MOD_CHAR;
 }
 
-//TODO: handle escape characters
+// String literals are measured first and then copied once into the AST
+// arena, decoding escapes on the way when there are any.
 void scan_string()
 {
     assert(*lex.current == '"');
     lex.current++;
-    char *str = NULL;
+    const char* start = lex.current;
+    bool has_escapes = false;
     while(*lex.current != '"' && !is_at_end())
     {
-        if(*lex.current == '\n')
+        if(*lex.current == '\\')
         {
-            lex.line++;
+            has_escapes = true;
+            if(lex.current[1])
+            {
+                lex.current++;
+            }
         }
-        buf_push(str, *lex.current);
         lex.current++;
     }
+    const char* end = lex.current;
     if(*lex.current)
     {
         lex.current++;
     }
     else
     {
-        fatal_error("Unexpected end of file within string literal");
+        error("Unexpected end of file within string literal");
+    }
+    char* str = arena_alloc(&ast_arena, end - start + 1);
+    if(has_escapes)
+    {
+        char* out = str;
+        lex.current = start;
+        while(lex.current < end)
+        {
+            if(*lex.current == '\\')
+            {
+                lex.current++;
+                *out++ = scan_escape();
+            }
+            else
+            {
+                *out++ = *lex.current++;
+            }
+        }
+        *out = 0;
+        lex.current = *end == '"' ? end + 1 : end;
+    }
+    else
+    {
+        memcpy(str, start, end - start);
+        str[end - start] = 0;
     }
-    buf_push(str, 0);
     tok.type = TOKEN_STR;
     tok.str_val = str;
-    tok.line = lex.line;
 }
 
-#define KEYWORD(name) name##_keyword = str_intern(#name); buf_push(keywords, name##_keyword)
+#define KEYWORD(name, id) \
+    name##_keyword = str_intern(#name); \
+    assert(intern_id(name##_keyword) == id); \
+    keywords[id] = name##_keyword
 
+// Keywords must be the first strings interned so that they own the leading
+// id range and is_keyword_name is a single compare.
 void init_keywords()
 {
     static bool inited;
@@ -259,27 +916,24 @@ void init_keywords()
     {
         return;
     }
-    KEYWORD(struct);
-    KEYWORD(enum);
-    KEYWORD(union);
-    KEYWORD(let);
-    KEYWORD(fn);
-    KEYWORD(const);
-    KEYWORD(if);
-    KEYWORD(else);
-    KEYWORD(for);
-    KEYWORD(while);
-    KEYWORD(switch);
-    KEYWORD(break);
-	KEYWORD(continue);
-    KEYWORD(err);
-    KEYWORD(import);
-    KEYWORD(extern);
-    KEYWORD(in);
-    KEYWORD(return);
-
-    first_keyword = struct_keyword;
-    last_keyword = return_keyword;
+    KEYWORD(struct, KEYWORD_STRUCT);
+    KEYWORD(enum, KEYWORD_ENUM);
+    KEYWORD(union, KEYWORD_UNION);
+    KEYWORD(let, KEYWORD_LET);
+    KEYWORD(fn, KEYWORD_FN);
+    KEYWORD(const, KEYWORD_CONST);
+    KEYWORD(if, KEYWORD_IF);
+    KEYWORD(else, KEYWORD_ELSE);
+    KEYWORD(for, KEYWORD_FOR);
+    KEYWORD(while, KEYWORD_WHILE);
+    KEYWORD(switch, KEYWORD_SWITCH);
+    KEYWORD(break, KEYWORD_BREAK);
+    KEYWORD(continue, KEYWORD_CONTINUE);
+    KEYWORD(err, KEYWORD_ERR);
+    KEYWORD(import, KEYWORD_IMPORT);
+    KEYWORD(extern, KEYWORD_EXTERN);
+    KEYWORD(in, KEYWORD_IN);
+    KEYWORD(return, KEYWORD_RETURN);
 
     inited = true;
 }
@@ -288,9 +942,56 @@ void init_keywords()
 
 bool is_keyword_name(const char* name)
 {
-    return first_keyword <= name && name <= last_keyword;
+    return intern_id(name) < NUM_KEYWORDS;
+}
+
+// Perfect hash over the keyword set: (3*(first + last char) + length) & 31
+// maps every keyword to a distinct slot, so a name is classified with one
+// probe and one memcmp without touching the interner. The constants were
+// searched for offline; re-check them if a keyword is added.
+typedef struct
+{
+    const char* str;
+    u8 len;
+    u8 id;
+} keyword_slot;
+
+#define KEYWORD_HASH(s, len) ((3*((u8)(s)[0] + (u8)(s)[(len) - 1]) + (len)) & 31)
+
+static const keyword_slot keyword_slots[32] =
+{
+    [0]  = {"continue", 8, KEYWORD_CONTINUE},
+    [2]  = {"else", 4, KEYWORD_ELSE},
+    [3]  = {"let", 3, KEYWORD_LET},
+    [6]  = {"return", 6, KEYWORD_RETURN},
+    [7]  = {"in", 2, KEYWORD_IN},
+    [8]  = {"err", 3, KEYWORD_ERR},
+    [10] = {"const", 5, KEYWORD_CONST},
+    [11] = {"for", 3, KEYWORD_FOR},
+    [12] = {"break", 5, KEYWORD_BREAK},
+    [14] = {"union", 5, KEYWORD_UNION},
+    [15] = {"if", 2, KEYWORD_IF},
+    [23] = {"switch", 6, KEYWORD_SWITCH},
+    [25] = {"while", 5, KEYWORD_WHILE},
+    [26] = {"enum", 4, KEYWORD_ENUM},
+    [27] = {"struct", 6, KEYWORD_STRUCT},
+    [29] = {"import", 6, KEYWORD_IMPORT},
+    [30] = {"fn", 2, KEYWORD_FN},
+    [31] = {"extern", 6, KEYWORD_EXTERN},
+};
+
+const char* keyword_lookup(const char* start, size_t len)
+{
+    const keyword_slot* slot = &keyword_slots[KEYWORD_HASH(start, len)];
+    if(slot->len == len && memcmp(slot->str, start, len) == 0)
+    {
+        return keywords[slot->id];
+    }
+    return NULL;
 }
 
+#undef KEYWORD_HASH
+
 #define CASE1(c1, k1) \
     case c1: \
         tok.type = k1; \
@@ -316,27 +1017,21 @@ bool is_keyword_name(const char* name)
             lex.current++; \
         } \
         else if(*lex.current == c3) { \
-            tok.type = c3;\
+            tok.type = k3;\
             lex.current++;\
         }\
         break;
 
-void next_token()
+void scan_token()
 {
     tok.start = lex.current;
     tok.mod = 0;
 
     switch(*lex.current)
     {
-    case ' ': case '\n': case '\r': case '\t': case '\v':
-        while(isspace(*lex.current))
-        {
-            if(*lex.current++ == '\n')
-            {
-                lex.line++;
-            }
-        }
-        return next_token();
+    case ' ': case '\n': case '\r': case '\t': case '\v': case '\f':
+        lex.current = lex_simd.skip_space(lex.current);
+        return scan_token();
     case '\'':
         scan_char();
         break;
@@ -344,9 +1039,9 @@ void next_token()
         scan_string();
         break;
     case '.':
-        if(isdigit(lex.current[1]))
+        if(is_digit(lex.current[1]))
         {
-            scan_float();
+            scan_number();
         }
         else
         {
@@ -355,35 +1050,25 @@ void next_token()
         }
         break;
     case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
-    {
-        while(isdigit(*lex.current))
-        {
-            lex.current++;
-        }
-        char c = *lex.current;
-        lex.current = tok.start;
-        if(c == '.')
-        {
-            scan_float();
-        }
-        else
-        {
-            scan_int();
-        }
+        scan_number();
         break;
-    }
     case 'a': case 'b': case 'c': case 'd': case 'e': case 'f': case 'g': case 'h': case 'i': case 'j':
     case 'k': case 'l': case 'm': case 'n': case 'o': case 'p': case 'q': case 'r': case 's': case 't':
     case 'u': case 'v': case 'w': case 'x': case 'y': case 'z':
     case 'A': case 'B': case 'C': case 'D': case 'E': case 'F': case 'G': case 'H': case 'I': case 'J':
     case 'K': case 'L': case 'M': case 'N': case 'O': case 'P': case 'Q': case 'R': case 'S': case 'T':
     case 'U': case 'V': case 'W': case 'X': case 'Y': case 'Z':
-        while(isalnum(*lex.current) || *lex.current == '_')
+        lex.current = lex_simd.skip_ident(lex.current);
+        tok.name = keyword_lookup(tok.start, lex.current - tok.start);
+        if(tok.name)
         {
-            lex.current++;
+            tok.type = TOKEN_KEYWORD;
+        }
+        else
+        {
+            tok.name = str_intern_range(tok.start, lex.current);
+            tok.type = TOKEN_NAME;
         }
-        tok.name = str_intern_range(tok.start, lex.current);
-        tok.type = is_keyword_name(tok.name) ? TOKEN_KEYWORD : TOKEN_NAME;
         break;
     case '<':
         tok.type = TOKEN_LT;
@@ -407,7 +1092,7 @@ void next_token()
     case '>':
         tok.type = TOKEN_GT;
         lex.current++;
-        if(*lex.current == '<')
+        if(*lex.current == '>')
         {
             tok.type = TOKEN_RSHIFT;
             lex.current++;
@@ -433,12 +1118,8 @@ void next_token()
         }
         else if(*lex.current == '/')
         {
-            lex.current++;
-            while(*lex.current && *lex.current != '\n')
-            {
-                lex.current++;
-            }
-            return next_token();
+            lex.current = lex_simd.skip_line(lex.current + 1);
+            return scan_token();
         }
         break;
 
@@ -469,7 +1150,7 @@ void next_token()
     default:
         error("No token of found");
         lex.current++;
-        next_token();
+        scan_token();
     }
 }
 
@@ -477,12 +1158,192 @@ void next_token()
 #undef CASE2
 #undef CASE3
 
-void init_lex(const char* source)
+// Whole-file tokenization. The scanner above runs in one tight loop over the
+// source and its output is stored as parallel arrays: a one-byte kind and a
+// source offset for every token, plus a side table holding the literal or
+// name of just the tokens that carry one. The parser walks the arrays with a
+// cursor, which gives it arbitrary lookahead for free, and a buffer can be
+// parsed again without lexing the file a second time.
+typedef struct
 {
+    token_mod mod;
+    union
+    {
+        u64 int_val;
+        f64 float_val;
+        const char* str_val;
+        const char* name;
+    };
+} token_value;
+
+typedef struct
+{
+    const char* path;
+    const char* source;
+    u32 base;
+    u8* kinds;
+    u32* offsets;
+    token_value* values;
+} token_buffer;
+
+typedef struct
+{
+    token_buffer* tokens;
+    u32 pos;
+    u32 value_pos;
+} token_cursor;
+
+_Thread_local token_buffer lex_tokens;
+_Thread_local token_cursor cursor;
+
+static bool token_has_value(token_type type)
+{
+    return type == TOKEN_INT || type == TOKEN_FLOAT || type == TOKEN_STR || type == TOKEN_NAME || type == TOKEN_KEYWORD;
+}
+
+// Lexes source that is already in the source map at base, so the same text
+// can be lexed again without taking up more of the position space.
+void tokenize_at(token_buffer* tokens, const char* path, const char* source, u32 base)
+{
+    buf_clear(tokens->kinds);
+    buf_clear(tokens->offsets);
+    buf_clear(tokens->values);
+    tokens->path = path;
+    tokens->source = source;
+    tokens->base = base;
+    lex.path = path;
     lex.start = source;
     lex.current = source;
-    lex.line = 1;
-    next_token();
+    lex.base = tokens->base;
+    do
+    {
+        scan_token();
+        assert(tok.start - source <= UINT32_MAX);
+        buf_push(tokens->kinds, (u8)tok.type);
+        buf_push(tokens->offsets, (u32)(tok.start - source));
+        if(token_has_value(tok.type))
+        {
+            token_value val = {tok.mod};
+            val.int_val = tok.int_val;
+            buf_push(tokens->values, val);
+        }
+    } while(tok.type != TOKEN_EOF);
+}
+
+void tokenize_file(token_buffer* tokens, const char* path, const char* source)
+{
+    tokenize_at(tokens, path, source, source_map_add(path, source, strlen(source)));
+}
+
+void token_buffer_free(token_buffer* tokens)
+{
+    buf_free(tokens->kinds);
+    buf_free(tokens->offsets);
+    buf_free(tokens->values);
+    tokens->source = NULL;
+}
+
+static void load_token()
+{
+    token_buffer* tokens = cursor.tokens;
+    tok.type = tokens->kinds[cursor.pos];
+    tok.start = tokens->source + tokens->offsets[cursor.pos];
+    tok.mod = MOD_NONE;
+    tok.int_val = 0;
+    if(token_has_value(tok.type))
+    {
+        token_value* val = &tokens->values[cursor.value_pos];
+        tok.mod = val->mod;
+        tok.int_val = val->int_val;
+    }
+}
+
+void init_parse_tokens(token_buffer* tokens)
+{
+    cursor = (token_cursor){tokens};
+    lex.path = tokens->path;
+    lex.start = tokens->source;
+    lex.base = tokens->base;
+    load_token();
+}
+
+void init_lex(const char* source)
+{
+    tokenize_file(&lex_tokens, "<source>", source);
+    init_parse_tokens(&lex_tokens);
+}
+
+void next_token()
+{
+    if(tok.type == TOKEN_EOF)
+    {
+        return;
+    }
+    if(token_has_value(tok.type))
+    {
+        cursor.value_pos++;
+    }
+    cursor.pos++;
+    load_token();
+}
+
+token_cursor save_cursor()
+{
+    return cursor;
+}
+
+void restore_cursor(token_cursor saved)
+{
+    cursor = saved;
+    if(cursor.tokens)
+    {
+        lex.path = cursor.tokens->path;
+        lex.start = cursor.tokens->source;
+        lex.base = cursor.tokens->base;
+        load_token();
+    }
+}
+
+// Moves past a balanced {...} group without parsing it, keeping the side
+// table position in step with the tokens that are skipped.
+void skip_token_block()
+{
+    const u8* kinds = cursor.tokens->kinds;
+    assert(kinds[cursor.pos] == TOKEN_LBRACE);
+    u32 pos = cursor.pos;
+    u32 value_pos = cursor.value_pos;
+    i32 depth = 0;
+    for(;;)
+    {
+        token_type kind = kinds[pos];
+        if(kind == TOKEN_EOF)
+        {
+            break;
+        }
+        value_pos += token_has_value(kind);
+        pos++;
+        if(kind == TOKEN_LBRACE)
+        {
+            depth++;
+        }
+        else if(kind == TOKEN_RBRACE && --depth == 0)
+        {
+            break;
+        }
+    }
+    cursor.pos = pos;
+    cursor.value_pos = value_pos;
+    load_token();
+    if(depth != 0)
+    {
+        error("Unexpected end of file within block");
+    }
+}
+
+token_type peek_token(u32 n)
+{
+    u32 last = buf_len(cursor.tokens->kinds) - 1;
+    return cursor.tokens->kinds[MIN(cursor.pos + n, last)];
 }
 
 const char* token_info()
@@ -496,7 +1357,7 @@ const char* token_info()
 
 bool is_token(token_type type)
 {
-    return tok.type == type;
+    return cursor.tokens->kinds[cursor.pos] == type;
 }
 
 bool is_token_eof()
@@ -546,6 +1407,7 @@ bool expect_token(token_type type)
 	}
 	else
 	{
-		error("expected token %s, got %s", token_type_name(type), token_info());
+		syntax_error("expected token %s, got %s", token_type_name(type), token_info());
+		return false;
 	}
 }
@@ -133,6 +133,7 @@ const char *token_type_names[] =
     [TOKEN_DEC] = "--",
     [TOKEN_COLON_ASSIGN] = ":=",
     [TOKEN_ARROW] = "=>",
+    [TOKEN_UNDERSCORE] = "_",
 };
 
 const char *token_type_name(token_type type)
@@ -166,9 +167,30 @@ const char* extern_keyword;
 const char* in_keyword;
 const char* return_keyword;
 
-const char* first_keyword;
-const char* last_keyword;
-const char** keywords;
+typedef enum
+{
+    KEYWORD_STRUCT,
+    KEYWORD_ENUM,
+    KEYWORD_UNION,
+    KEYWORD_LET,
+    KEYWORD_FN,
+    KEYWORD_CONST,
+    KEYWORD_IF,
+    KEYWORD_ELSE,
+    KEYWORD_FOR,
+    KEYWORD_WHILE,
+    KEYWORD_SWITCH,
+    KEYWORD_BREAK,
+    KEYWORD_CONTINUE,
+    KEYWORD_ERR,
+    KEYWORD_IMPORT,
+    KEYWORD_EXTERN,
+    KEYWORD_IN,
+    KEYWORD_RETURN,
+    NUM_KEYWORDS,
+} keyword_id;
+
+const char* keywords[NUM_KEYWORDS];
 
 token_type assign_token_to_binary_token[NUM_TOKEN_KINDS] =
 {
@@ -186,8 +208,6 @@ typedef struct
     token_type type;
     token_mod mod;
     const char* start;
-    i32 length;
-    i32 line;
     union
     {
         unsigned long long int_val;
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -8,21 +9,771 @@
 #include <stdint.h>
 #include <ctype.h>
 #include <limits.h>
+#include <float.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "common.c"
 #include "lexer.c"
 #include "ast.c"
 #include "parse.c"
+#include "cache.c"
+#include "stats.c"
+#include "resolve.c"
+#include "types.c"
+#include "driver.c"
+#include "bench.c"
+
+#undef MEM_TAG
+#define MEM_TAG MEM_OTHER
 
 #define assert_token_int(x) assert(tok.int_val == (x) && match_token(TOKEN_INT))
 #define assert_token_float(x) assert(tok.float_val == (x) && match_token(TOKEN_FLOAT))
 #define assert_token_eof() assert(is_token(0))
 #define assert_token_str(x) assert(strcmp(tok.str_val, (x)) == 0 && match_token(TOKEN_STR))
 
-int main(int argc, char **argv)
+void* test_lex_thread(void* arg)
 {
-    init_keywords();
+    char source[64];
+    const char** names = arg;
+    for(int i = 0; i < 2000; i++)
+    {
+        snprintf(source, sizeof(source), "let shared_%d := unique_%p_%d;", i % 100, arg, i);
+        init_lex(source);
+        assert(match_keyword(let_keyword));
+        names[i % 100] = tok.name;
+        assert(match_token(TOKEN_NAME) && match_token(TOKEN_COLON_ASSIGN) && match_token(TOKEN_NAME));
+    }
+    return NULL;
+}
+
+void test_lex_kernels(const lex_kernels* k)
+{
+    const char* pieces[] = {" ", "\n", "\t\r\n", "foo_Bar9", "1234567", "// comment\n", "+", "x", "\f\v"};
+    char text[512];
+    u32 seed = 1;
+    for(int round = 0; round < 200; round++)
+    {
+        int len = 0;
+        while(len < 400)
+        {
+            seed = seed*1103515245 + 12345;
+            const char* piece = pieces[(seed >> 16) % (sizeof(pieces)/sizeof(*pieces))];
+            memcpy(text + len, piece, strlen(piece));
+            len += strlen(piece);
+        }
+        text[len] = 0;
+        for(int i = 0; i < len; i++)
+        {
+            assert(k->skip_space(text + i) == skip_space_scalar(text + i));
+            assert(k->skip_ident(text + i) == skip_ident_scalar(text + i));
+            assert(k->skip_digits(text + i) == skip_digits_scalar(text + i));
+            assert(k->skip_line(text + i) == skip_line_scalar(text + i));
+        }
+    }
+}
+
+void test_parse()
+{
+    init_lex(
+        "fn main()\n"
+        "{\n"
+        "  let foo: i32 = 10;\n"
+        "  let bar := &foo;\n"
+        "  if(foo > 1 && bar[0] >= foo*2) { foo += 1; } else if(!foo) { return; } else { foo--; }\n"
+        "  while(foo) { foo = foo >> 1; }\n"
+        "  switch(foo) { => 1 => 2 f(foo, 1).x = 3; _ break; }\n"
+        "  return;\n"
+        "}\n"
+        "struct point { x: i32; y: f32 = 1.5; }\n"
+        "enum color { red; green = 2; blue; }\n"
+        "const size: i64 = 1 + 2*3;\n"
+        "let table: i32[4]^ = (:i32[4]){1, 2, 3, 4};\n"
+        "fn add(a: i32, b: i32): i32 { return a + b; }\n");
+    decl* d = parse_decl();
+    assert(d->type == DECL_FUNC && d->name == str_intern("main"));
+    assert(func_decl_body(d)->num_stmts == 6);
+    stmt* s = stmt_at(func_decl_body(d)->stmt[2]);
+    assert(s->type == STMT_IF && s->if_stmt.num_elseifs == 1 && s->if_stmt.else_block.num_stmts == 1);
+    expr* cond = expr_at(s->if_stmt.cond);
+    assert(cond->type == EXPR_BINARY && cond->op == TOKEN_AND_AND);
+    source_loc loc = source_map_lookup(s->pos);
+    assert(loc.line == 5 && loc.col == 3);
+    loc = source_map_lookup(cond->pos);
+    assert(loc.line == 5 && loc.col == 14);
+    s = stmt_at(func_decl_body(d)->stmt[4]);
+    assert(s->type == STMT_SWITCH && s->switch_stmt.num_cases == 2);
+    assert(s->switch_stmt.cases[0].num_exprs == 2 && s->switch_stmt.cases[1].is_default);
+    d = parse_decl();
+    assert(d->type == DECL_STRUCT && d->aggregate_decl.num_items == 2);
+    assert(d->aggregate_decl.items[1].name == str_intern("y") && d->aggregate_decl.items[1].init->type == EXPR_FLOAT);
+    d = parse_decl();
+    assert(d->type == DECL_ENUM && d->enum_decl.num_items == 3);
+    d = parse_decl();
+    assert(d->type == DECL_CONST && d->const_decl.type->type == TYPESPEC_NAME);
+    assert(d->const_decl.expr->op == TOKEN_ADD && expr_at(d->const_decl.expr->binary.right)->op == TOKEN_MUL);
+    d = parse_decl();
+    assert(d->type == DECL_VAR && d->var_decl.type->type == TYPESPEC_PTR);
+    assert(d->var_decl.expr->type == EXPR_COMPOUND && d->var_decl.expr->compound.num_args == 4);
+    d = parse_decl();
+    assert(d->type == DECL_FUNC && d->func_decl.num_params == 2 && d->func_decl.num_return == 1);
+    assert_token_eof();
+
+    init_lex("a - b - c < d + e*-f || g && h ? i : j ? k : l");
+    expr* e = parse_expr();
+    assert(e->type == EXPR_TERNARY && expr_at(e->ternary.else_expr)->type == EXPR_TERNARY);
+    e = expr_at(e->ternary.cond);
+    assert(e->op == TOKEN_OR_OR && expr_at(e->binary.right)->op == TOKEN_AND_AND);
+    e = expr_at(e->binary.left);
+    expr* mul = expr_at(expr_at(e->binary.right)->binary.right);
+    assert(e->op == TOKEN_LT && mul->op == TOKEN_MUL && expr_at(mul->binary.right)->type == EXPR_UNARY);
+    e = expr_at(e->binary.left);
+    assert(e->op == TOKEN_SUB && expr_at(e->binary.left)->op == TOKEN_SUB && expr_at(e->binary.right)->type == EXPR_NAME);
+    assert_token_eof();
+
+    //ERROR RECOVERY TEST
+    init_lex(
+        "fn f(x: i32) { let y := x + ; foo bar; if(x) { return 1 } y = 2; while( }\n"
+        "struct s { a: i32 b: f32; }\n"
+        ") ) let z = 3\n"
+        "const w = 4;\n");
+    error_count = 0;
+    decl** decls = NULL;
+    while(!is_token_eof())
+    {
+        decl* decl = parse_decl();
+        if(decl)
+        {
+            buf_push(decls, decl);
+        }
+    }
+    assert(buf_len(decls) == 4 && decls[1]->aggregate_decl.num_items == 1 && decls[3]->name == str_intern("w"));
+    assert(error_count == 7 && buf_len(diagnostics) == 7);
+    assert(strcmp(diagnostics[1].msg, "expected token ;, got bar") == 0);
+    assert(source_map_lookup(diagnostics[1].pos).col == 35);
+    assert(buf_len(parse_scratch) == 0);
+    diagnostics_free(&diagnostics);
+    buf_free(decls);
+    error_count = 0;
+
+    //TYPESPEC HASH-CONSING TEST
+    init_lex("let a: i32^[4]; let b: i32^[4]; let c: i32^[n]; let d: fn(i32^, f32): i32[]; let e: fn(i32^, f32): i32[];");
+    decl* types[5];
+    for(int i = 0; i < 5; i++)
+    {
+        types[i] = parse_decl();
+    }
+    assert(types[0]->var_decl.type == types[1]->var_decl.type && types[0]->var_decl.type->array.size->int_val == 4);
+    assert(types[2]->var_decl.type != types[0]->var_decl.type && types[2]->var_decl.type->array.elem == types[0]->var_decl.type->array.elem);
+    assert(types[3]->var_decl.type == types[4]->var_decl.type && types[3]->var_decl.type->func.args[0] == types[0]->var_decl.type->array.elem);
+    assert(types[3]->var_decl.type->func.rets[0]->array.size == NULL);
+    assert(source_map_lookup(types[1]->var_decl.type->pos).col == source_map_lookup(types[0]->var_decl.type->pos).col);
+    // The argument list starts above an odd number of 4-byte statement
+    // handles, so it has to be padded to be read in place.
+    init_lex("fn h(): i32 { a := 1; let g: fn(i32, f32): i32; b := a; return b; }");
+    d = parse_decl();
+    assert(func_decl_body(d)->num_stmts == 4 && stmt_at(func_decl_body(d)->stmt[3])->type == STMT_RETURN);
+    typespec* func = stmt_at(func_decl_body(d)->stmt[1])->decl->var_decl.type;
+    assert(func->func.num_args == 2 && func->func.num_rets == 1 && func->func.args[0] == types[0]->var_decl.type->array.elem->ptr.elem);
+    assert(buf_len(parse_scratch) == 0);
+
+    //LAZY BODY TEST
+    parse_lazy_bodies = true;
+    init_lex("fn f(x: i32) { if(x) { let y := \"s\"; { } } return x + 1; } fn g() { return; } let z := 3;");
+    decl* f = parse_decl();
+    assert(f->func_decl.block.num_stmts == 0 && f->func_decl.body.tokens);
+    decl* g = parse_decl();
+    assert(is_keyword(let_keyword));
+    s_block* body = func_decl_body(f);
+    assert(body->num_stmts == 2 && stmt_at(body->stmt[1])->type == STMT_RETURN);
+    assert(stmt_at(stmt_at(body->stmt[0])->if_stmt.then_block.stmt[0])->decl->var_decl.expr->type == EXPR_STR);
+    assert(func_decl_body(f) == body && body->num_stmts == 2);
+    assert(is_keyword(let_keyword));
+    d = parse_decl();
+    assert(d->type == DECL_VAR && d->var_decl.expr->int_val == 3);
+    assert(func_decl_body(g)->num_stmts == 1);
+    assert_token_eof();
+    assert(buf_len(parse_scratch) == 0);
+    parse_lazy_bodies = false;
+}
+
+typedef struct
+{
+    int counts[AST_STMT + 1];
+    int num_post;
+    int depth;
+    int max_depth;
+    const char* names[8];
+    int num_names;
+} walk_test;
+
+walk_action walk_test_pre(void* ctx, ast_node node)
+{
+    walk_test* t = ctx;
+    t->counts[node.kind]++;
+    t->depth++;
+    t->max_depth = MAX(t->max_depth, t->depth);
+    if(node.kind == AST_EXPR && node.expr->type == EXPR_NAME && t->num_names < 8)
+    {
+        t->names[t->num_names++] = node.expr->name;
+    }
+    if(node.kind == AST_STMT && node.stmt->type == STMT_WHILE)
+    {
+        t->depth--;
+        return WALK_SKIP;
+    }
+    return WALK_CONTINUE;
+}
+
+walk_action walk_test_post(void* ctx, ast_node node)
+{
+    walk_test* t = ctx;
+    t->num_post++;
+    t->depth--;
+    return WALK_CONTINUE;
+}
+
+walk_action walk_test_stop(void* ctx, ast_node node)
+{
+    walk_test* t = ctx;
+    t->counts[node.kind]++;
+    return node.kind == AST_EXPR && node.expr->type == EXPR_CALL ? WALK_STOP : WALK_CONTINUE;
+}
+
+void test_ast_walk()
+{
+    init_lex("fn f(a: i32, b: i32^): i32 { let x := g(a, b[0], c); while(x) { y = z; } return x ? a : h; }");
+    decl* f = parse_decl();
+    walk_test t = {0};
+    ast_walker w = {walk_test_pre, walk_test_post, &t};
+    assert(ast_walk(&w, AST_DECL, f));
+    // The while loop is skipped, condition and body included.
+    assert(t.counts[AST_DECL] == 2 && t.counts[AST_STMT] == 3 && t.counts[AST_TYPESPEC] == 4);
+    assert(t.counts[AST_EXPR] == 11 && t.num_post == 19 && t.depth == 0 && t.max_depth == 6);
+    const char* names[] = {"g", "a", "b", "c", "x", "a", "h"};
+    assert(t.num_names == 7);
+    for(int i = 0; i < 7; i++)
+    {
+        assert(t.names[i] == str_intern(names[i]));
+    }
+
+    walk_test stop = {0};
+    w = (ast_walker){walk_test_stop, NULL, &stop, w.stack};
+    assert(!ast_walk(&w, AST_DECL, f));
+    assert(stop.counts[AST_EXPR] == 1 && stop.counts[AST_STMT] == 1);
+
+    // A long left-leaning chain is as deep as it's long.
+    char* source = NULL;
+    buf_printf(source, "let deep := 0");
+    for(int i = 0; i < 100000; i++)
+    {
+        buf_printf(source, " + 1");
+    }
+    buf_printf(source, ";");
+    init_lex(source);
+    walk_test deep = {0};
+    w = (ast_walker){walk_test_pre, walk_test_post, &deep, w.stack};
+    assert(ast_walk(&w, AST_DECL, parse_decl()));
+    assert(deep.counts[AST_EXPR] == 200001 && deep.max_depth == 100002);
+    ast_walker_free(&w);
+    buf_free(source);
+}
+
+static decl** parse_all(const char* source)
+{
+    init_lex(source);
+    decl** decls = NULL;
+    while(!is_token_eof())
+    {
+        buf_push(decls, parse_decl());
+    }
+    return decls;
+}
+
+void test_resolve()
+{
+    decl** decls = parse_all(
+        "fn main(n: i32): i32\n"
+        "{\n"
+        "  let total: i64 = 0;\n"
+        "  for(i := 0; i < n; i++) { x := i*2; total += x + limit; }\n"
+        "  { total := 1; total += 2; }\n"
+        "  return helper(total);\n"
+        "}\n"
+        "fn helper(v: i64): point { return v; }\n"
+        "struct point { x: i32; next: point^; }\n"
+        "const limit = 10;\n");
+    error_count = 0;
+    resolve_package(decls, buf_len(decls));
+    assert(error_count == 0);
+    stmt* body[4];
+    for(size_t i = 0; i < 4; i++)
+    {
+        body[i] = stmt_at(decls[0]->func_decl.block.stmt[i]);
+    }
+    sym* total = stmt_at(body[2]->block.stmt[0])->init.sym;
+    for_stmt* loop = &body[1]->for_stmt;
+    sym* i = stmt_at(loop->init)->init.sym;
+    expr* cond = expr_at(loop->cond);
+    assert(i->kind == SYM_LOCAL && expr_at(cond->binary.left)->sym == i);
+    sym* n = expr_at(cond->binary.right)->sym;
+    assert(n->kind == SYM_PARAM && n->param == &decls[0]->func_decl.param_list[0]);
+    stmt* add = stmt_at(loop->block.stmt[1]);
+    expr* sum = expr_at(add->assign.right);
+    assert(expr_at(add->assign.left)->sym->decl == body[0]->decl && expr_at(sum->binary.left)->sym == stmt_at(loop->block.stmt[0])->init.sym);
+    sym* limit = expr_at(sum->binary.right)->sym;
+    assert(limit->kind == SYM_CONST && limit->decl == decls[3]);
+    // The inner total shadows the outer one only inside its block.
+    assert(total->kind == SYM_LOCAL && expr_at(stmt_at(body[2]->block.stmt[1])->assign.left)->sym == total);
+    expr* call = expr_at(body[3]->return_stmt.expr);
+    sym* helper = expr_at(call->call.expr)->sym;
+    assert(helper->kind == SYM_FUNC && helper->decl == decls[1]);
+    assert(expr_at(call->call.args[0])->sym->decl == body[0]->decl);
+    typespec* ret = decls[1]->func_decl.return_type[0];
+    assert(ret->sym == resolve_global(str_intern("point")) && ret->sym->kind == SYM_TYPE && ret->sym->decl == decls[2]);
+    assert(decls[2]->aggregate_decl.items[1].type->ptr.elem->sym == ret->sym);
+    assert(decls[0]->func_decl.param_list[0].type->sym->kind == SYM_TYPE && !decls[0]->func_decl.param_list[0].type->sym->decl);
+    assert(resolve_lookup(str_intern("total")) == NULL && buf_len(res.shadowed) == 0);
+    buf_free(decls);
+
+    decls = parse_all(
+        "fn f(a: i32) { a := 1; b = c; let d: f = 1; { e := 1; } e = 2; fn g() {} let h: nope; }\n"
+        "let f: i32 = 0;\n");
+    resolve_package(decls, buf_len(decls));
+    const char* errors[] =
+    {
+        "Duplicate declaration of f", "Duplicate declaration of a", "Undeclared name b", "Undeclared name c",
+        "f is not a type", "Undeclared name e", "fn declarations are only allowed at file scope", "Undeclared type nope",
+    };
+    assert(error_count == 8 && buf_len(diagnostics) == 8);
+    for(int i = 0; i < 8; i++)
+    {
+        assert(strcmp(diagnostics[i].msg, errors[i]) == 0);
+    }
+    diagnostics_free(&diagnostics);
+    error_count = 0;
+    buf_free(decls);
+
+    // Thousands of locals and a long operator chain.
+    char* source = NULL;
+    buf_printf(source, "fn big(x: i32): i32 {");
+    for(int i = 0; i < 5000; i++)
+    {
+        buf_printf(source, " v%d := %d;", i, i);
+    }
+    buf_printf(source, " return x");
+    for(int i = 0; i < 100000; i++)
+    {
+        buf_printf(source, " + v%d", i % 5000);
+    }
+    buf_printf(source, "; }");
+    decls = parse_all(source);
+    resolve_package(decls, buf_len(decls));
+    assert(error_count == 0);
+    s_block* block = &decls[0]->func_decl.block;
+    expr* e = expr_at(stmt_at(block->stmt[5000])->return_stmt.expr);
+    assert(expr_at(e->binary.right)->sym == stmt_at(block->stmt[4999])->init.sym);
+    while(e->type == EXPR_BINARY)
+    {
+        e = expr_at(e->binary.left);
+    }
+    assert(e->sym->kind == SYM_PARAM);
+    buf_free(decls);
+    buf_free(source);
+    resolve_reset();
+}
+
+static sym* local_sym(decl* func, size_t i)
+{
+    stmt* s = stmt_at(func_decl_body(func)->stmt[i]);
+    return s->type == STMT_INIT ? s->init.sym : s->decl->sym;
+}
+
+void test_check()
+{
+    decl** decls = parse_all(
+        "fn main(): i32\n"
+        "{\n"
+        "  p := (:point){1, 2.5};\n"
+        "  let c := color.green;\n"
+        "  let f := length(&p);\n"
+        "  let b := f > 1.0 && c == color.red;\n"
+        "  s := \"hi\";\n"
+        "  q := &table[1];\n"
+        "  for(i := 0; i < n; i++) { table[i] = i*2; p.x += i; }\n"
+        "  return p.x + *q;\n"
+        "}\n"
+        "let table: i32[n*2] = {1, 2, 3};\n"
+        "fn length(p: point^): f32 { return p.y + 1; }\n"
+        "struct point { x: i32; y: f32; next: point^; pair: u8[2]; }\n"
+        "union bits { i: i64; f: f32; }\n"
+        "enum color { red; green = 2; blue; }\n"
+        "const n = 4;\n"
+        "let deep: fn(i32^[4], f32): i32[2]^;\n"
+        "let alias: fn(i32^[4], f32): i32[2]^;\n");
+    error_count = 0;
+    resolve_package(decls, buf_len(decls));
+    check_package(decls, buf_len(decls));
+    assert(error_count == 0);
+    Type* point = decls[3]->sym->type;
+    assert(point->kind == TYPE_STRUCT && point->size == 24 && point->align == 8);
+    assert(point->aggregate.num_fields == 4 && point->aggregate.fields[3].offset == 16 && type_field_lookup(point, str_intern("next"))->type == type_ptr(point));
+    assert(decls[4]->sym->type->size == 8 && decls[4]->sym->type->align == 8);
+    Type* table = decls[1]->sym->type;
+    assert(table == type_array(type_i32, 8) && table->size == 32);
+    assert(decls[7]->sym->type == decls[8]->sym->type && decls[7]->sym->type->kind == TYPE_FUNC);
+    assert(decls[2]->sym->type == type_func((Type*[]){type_ptr(point)}, 1, (Type*[]){&builtin_types[TYPE_F32]}, 1));
+    Type* expected[] = {point, decls[5]->sym->type, &builtin_types[TYPE_F32], type_bool, type_ptr(type_u8), type_ptr(type_i32)};
+    for(size_t i = 0; i < NUM_NAMES(expected); i++)
+    {
+        assert(local_sym(decls[0], i)->type == expected[i]);
+    }
+    assert(stmt_at(stmt_at(func_decl_body(decls[0])->stmt[6])->for_stmt.init)->init.sym->type == type_i32);
+    assert(strcmp(type_str(decls[7]->sym->type), "fn(i32^[4], f32): i32[2]^") == 0);
+    buf_free(decls);
+
+    decls = parse_all(
+        "struct node { value: i32; self: node; }\n"
+        "fn f(a: i32, b: f32^): i32\n"
+        "{\n"
+        "  y := *a;\n"
+        "  a = 1.5;\n"
+        "  g(1);\n"
+        "  let z: u8 = a;\n"
+        "  b.value = 2;\n"
+        "  if(f) {}\n"
+        "  node;\n"
+        "  w := {1};\n"
+        "  1 = a;\n"
+        "  return;\n"
+        "}\n"
+        "fn g(): u8[2] { return {1, 2, 3}; }\n"
+        "let loop := loop;\n"
+        "let sized: i32[a];\n"
+        "let empty: i32[0];\n"
+        "let again: i32[0];\n"
+        "let big: i64[1000000000];\n");
+    resolve_package(decls, buf_len(decls));
+    assert(error_count == 1);
+    diagnostics_free(&diagnostics);
+    error_count = 0;
+    check_package(decls, buf_len(decls));
+    const char* errors[] =
+    {
+        "Type node contains itself", "Invalid operand i32 for *", "Cannot convert f64 to i32", "Expected 0 arguments, got 1",
+        "Cannot convert i32 to u8", "f32^ has no field value", "Condition of type fn(i32, f32^): i32 isn't a scalar",
+        "node is a type, not a value", "Compound literal has no type to take", "Cannot assign to a value that isn't stored anywhere",
+        "Missing return value in f", "Too many values in compound literal of type u8[2]", "Declaration of loop depends on itself",
+        "Array size must be a positive integer constant", "Array size must be a positive integer constant",
+        "Array size must be a positive integer constant", "Array too large",
+    };
+    assert(error_count == NUM_NAMES(errors) && buf_len(diagnostics) == NUM_NAMES(errors));
+    for(size_t i = 0; i < NUM_NAMES(errors); i++)
+    {
+        assert(strcmp(diagnostics[i].msg, errors[i]) == 0);
+    }
+    // The shared i32[0] is reported where each declaration uses it.
+    assert(source_map_lookup(diagnostics[14].pos).line == 18 && source_map_lookup(diagnostics[15].pos).line == 19);
+    diagnostics_free(&diagnostics);
+    error_count = 0;
+    buf_free(decls);
+
+    decls = parse_all(
+        "const A: i32 = B;\n"
+        "const B: i32 = A;\n"
+        "let x: u8[A];\n"
+        "union empty {}\n"
+        "let e := (:empty){1};\n"
+        "const M = 9223372036854775807;\n"
+        "let twice: u8[M*2];\n"
+        "let negated: u8[-(-9223372036854775807 - 1)];\n"
+        "let shifted: u8[1 << 70];\n"
+        "let wide: i64[1 << 30];\n");
+    resolve_package(decls, buf_len(decls));
+    check_package(decls, buf_len(decls));
+    const char* size_errors[] =
+    {
+        "Declaration of A depends on itself", "Array size must be a positive integer constant",
+        "Too many values in compound literal of type empty", "Array size must be a positive integer constant",
+        "Array size must be a positive integer constant", "Array size must be a positive integer constant", "Array too large",
+    };
+    assert(error_count == NUM_NAMES(size_errors) && buf_len(diagnostics) == NUM_NAMES(size_errors));
+    for(size_t i = 0; i < NUM_NAMES(size_errors); i++)
+    {
+        assert(strcmp(diagnostics[i].msg, size_errors[i]) == 0);
+    }
+    diagnostics_free(&diagnostics);
+    error_count = 0;
+    buf_free(decls);
+
+    // A long operator chain is checked without recursing.
+    char* source = NULL;
+    buf_printf(source, "fn big(x: i64): i64 { return x");
+    for(int i = 0; i < 100000; i++)
+    {
+        buf_printf(source, " + %d", i);
+    }
+    buf_printf(source, "; }");
+    decls = parse_all(source);
+    resolve_package(decls, buf_len(decls));
+    check_package(decls, buf_len(decls));
+    assert(error_count == 0 && buf_len(checker.operands) == 0 && buf_len(checker.frames) == 0);
+    buf_free(decls);
+    buf_free(source);
+    check_reset();
+    resolve_reset();
+}
+
+void test_ast_cache()
+{
+    char dir[] = "/tmp/uct_cache_XXXXXX";
+    assert(mkdtemp(dir));
+    ast_cache_dir = dir;
+    const char* source =
+        "fn main(n: i32): i32\n"
+        "{\n"
+        "  let s := \"str\\n\";\n"
+        "  for(i := 0; i < n; i++) { if(i > 2) { n -= f(i, -n)[1].x; } else if(!i) { break; } }\n"
+        "  switch(n) { => 1 => 2 return n ? 1 : 2; _ break; }\n"
+        "  return n;\n"
+        "}\n"
+        "struct point { x: i32; y: fn(i32)^[4] = {1, 2}; }\n"
+        "enum color { red; green = 2; }\n";
+    size_t len = strlen(source);
+    u64 hash = hash_bytes(source, len);
+    tokenize_file(&lex_tokens, "<cache>", source);
+    init_parse_tokens(&lex_tokens);
+    decl** parsed = NULL;
+    while(!is_token_eof())
+    {
+        buf_push(parsed, parse_decl());
+    }
+    ast_cache_store(hash, len, lex_tokens.base, parsed, buf_len(parsed));
+
+    decl** loaded = NULL;
+    assert(!ast_cache_load(&loaded, "<cache>", source, len, hash + 1));
+    assert(ast_cache_load(&loaded, "<cache>", source, len, hash));
+    assert(buf_len(loaded) == 3 && loaded[0] != parsed[0]);
+    for(size_t i = 0; i < 3; i++)
+    {
+        assert(loaded[i]->type == parsed[i]->type && loaded[i]->name == parsed[i]->name);
+        source_loc a = source_map_lookup(loaded[i]->pos);
+        source_loc b = source_map_lookup(parsed[i]->pos);
+        assert(a.line == b.line && a.col == b.col);
+    }
+    func_decl* func = &loaded[0]->func_decl;
+    assert(func->num_params == 1 && func->param_list[0].name == str_intern("n") && func->return_type[0]->name == str_intern("i32"));
+    stmt_ref* stmts = func->block.stmt;
+    assert(func->block.num_stmts == 4 && strcmp(stmt_at(stmts[0])->decl->var_decl.expr->str_val, "str\n") == 0);
+    stmt* loop = stmt_at(stmts[1]);
+    assert(stmt_at(loop->for_stmt.init)->init.name == str_intern("i") && stmt_at(loop->for_stmt.next)->op == TOKEN_INC);
+    stmt* branch = stmt_at(loop->for_stmt.block.stmt[0]);
+    assert(branch->if_stmt.num_elseifs == 1 && stmt_at(branch->if_stmt.elseifs[0].block.stmt[0])->type == STMT_BREAK);
+    stmt* assign = stmt_at(branch->if_stmt.then_block.stmt[0]);
+    expr* field = expr_at(assign->assign.right);
+    assert(assign->op == TOKEN_SUB_ASSIGN && field->field.name == str_intern("x"));
+    expr* call = expr_at(expr_at(field->field.expr)->index.expr);
+    assert(call->call.num_args == 2 && expr_at(call->call.args[1])->op == TOKEN_SUB);
+    switch_stmt* sw = &stmt_at(stmts[2])->switch_stmt;
+    assert(sw->num_cases == 2 && sw->cases[0].num_exprs == 2 && expr_at(sw->cases[0].exprs[1])->int_val == 2);
+    assert(expr_at(stmt_at(sw->cases[0].block.stmt[0])->return_stmt.expr)->type == EXPR_TERNARY && sw->cases[1].is_default);
+    aggregate_item* items = loaded[1]->aggregate_decl.items;
+    assert(items[1].type->type == TYPESPEC_ARRAY && items[1].type->array.elem->ptr.elem->func.args[0]->name == str_intern("i32"));
+    assert(items[1].init->compound.num_args == 2 && expr_at(items[1].init->compound.args[1])->int_val == 2);
+    assert(loaded[2]->enum_decl.num_items == 2 && loaded[2]->enum_decl.items[1].init->int_val == 2);
+
+    char* path = ast_cache_path(hash);
+    unlink(path);
+    buf_free(path);
+    rmdir(dir);
+    ast_cache_dir = NULL;
+    buf_free(parsed);
+    buf_free(loaded);
+}
+
+void test_driver()
+{
+    char dir[] = "/tmp/uct_pkg_XXXXXX";
+    assert(mkdtemp(dir));
+    const char** paths = NULL;
+    for(int i = 0; i < 8; i++)
+    {
+        char* path = NULL;
+        buf_printf(path, "%s/file%d.uct", dir, i);
+        FILE* f = fopen(path, "w");
+        for(int j = 0; j <= i; j++)
+        {
+            fprintf(f, "fn f%d_%d(x: i32): i32 { return x*%d; }\n", i, j, j);
+        }
+        fclose(f);
+    }
+    assert(collect_sources(&paths, dir));
+    assert(buf_len(paths) == 8);
+    parsed_file files[8] = {0};
+    for(int i = 0; i < 8; i++)
+    {
+        files[i].path = paths[i];
+    }
+    stats_mode = STATS_TEXT;
+    parse_files(files, 8, 3);
+    assert(total_stats.files == 8 && total_stats.decls[DECL_FUNC] == 36 && total_stats.exprs[EXPR_BINARY] == 36);
+    assert(total_stats.tokens[TOKEN_EOF] == 8 && total_stats.tokens[TOKEN_INT] == 36 && total_stats.typespecs[TYPESPEC_NAME] == 72);
+    assert(total_stats.arena_blocks >= 1);
+    stats_mode = STATS_NONE;
+    total_stats = (compile_stats){0};
+    for(int i = 0; i < 8; i++)
+    {
+        assert(files[i].num_errors == 0 && buf_len(files[i].decls) == (size_t)i + 1);
+        char name[32];
+        snprintf(name, sizeof(name), "f%d_%d", i, i);
+        assert(files[i].decls[i]->name == str_intern(name));
+        unlink(paths[i]);
+    }
+    rmdir(dir);
+}
+
+void test_bench_generate()
+{
+    for(int shape = 0; shape < NUM_SHAPES; shape++)
+    {
+        char* source = bench_generate(shape, 16*1024, 7);
+        char* again = bench_generate(shape, 16*1024, 7);
+        assert(buf_len(source) >= 16*1024 && buf_len(source) == buf_len(again) && memcmp(source, again, buf_len(source)) == 0);
+        init_lex(source);
+        while(!is_token_eof())
+        {
+            parse_decl();
+        }
+        assert(error_count == 0);
+        buf_free(source);
+        buf_free(again);
+    }
+}
+
+void test_arena(u32 flags)
+{
+    arena a = {.flags = flags};
+    char* first = arena_alloc(&a, 16);
+    arena_marker mark = arena_mark(&a);
+    char* scratch = arena_alloc(&a, 100);
+    for(int i = 0; i < 1000; i++)
+    {
+        memset(arena_alloc(&a, 1000), i, 1000);
+    }
+    assert(buf_len(a.blocks) < 16 && a.blocks[1].size == 2*a.blocks[0].size);
+    char* big = arena_alloc(&a, 64*1024*1024);
+    memset(big, 1, 64*1024*1024);
+    size_t size = arena_size(&a);
+    arena_rewind(&a, mark);
+    assert(arena_alloc(&a, 100) == scratch);
+    arena_reset(&a);
+    assert(arena_alloc(&a, 16) == first);
+    for(int i = 0; i < 1000; i++)
+    {
+        arena_alloc(&a, 1000);
+    }
+    arena_alloc(&a, 64*1024*1024);
+    assert(arena_size(&a) == size);
+    arena_free(&a);
+    assert(!a.blocks && arena_size(&a) == 0 && a.flags == flags);
+}
+
+void test_small_buf()
+{
+    small_buf(int, 4) v = {0};
+    int more[] = {2, 3, 4, 5, 6};
+    small_buf_push(v, 0);
+    small_buf_push(v, 1);
+    assert(small_buf_len(v) == 2 && !v.heap && small_buf_items(v) == v.inline_items);
+    small_buf_append(v, more, 2);
+    assert(small_buf_len(v) == 4 && !v.heap);
+    small_buf_append(v, more + 2, 3);
+    assert(small_buf_len(v) == 7 && v.heap && small_buf_cap(v) >= 8);
+    for(int i = 0; i < 7; i++)
+    {
+        assert(small_buf_items(v)[i] == i);
+    }
+    small_buf_free(v);
+    assert(small_buf_len(v) == 0 && small_buf_items(v) == v.inline_items);
+    char* b = NULL;
+    buf_append(b, "abc", 4);
+    assert(buf_len(b) == 4 && strcmp(b, "abc") == 0);
+    buf_free(b);
+}
+
+void test_mem_tracking()
+{
+    bool enabled = mem_stats.enabled;
+    mem_stats.enabled = true;
+    mem_counts before = mem_stats.tags[MEM_OTHER];
+    int* b = NULL;
+    for(int i = 0; i < 100; i++)
+    {
+        buf_push(b, i);
+    }
+    assert(mem_stats.tags[MEM_OTHER].live > before.live && mem_stats.tags[MEM_OTHER].count >= before.count + 2);
+    buf_free(b);
+    assert(mem_stats.tags[MEM_OTHER].live == before.live);
+    before = mem_stats.tags[MEM_SCRATCH];
+    arena a = {.tag = MEM_SCRATCH};
+    arena_alloc(&a, 3000);
+    arena_alloc(&a, 3000);
+    mem_counts* after = &mem_stats.tags[MEM_SCRATCH];
+    assert(after->count == before.count + 2 && after->live == before.live + 3*ARENA_MIN_BLOCK_SIZE);
+    assert(after->wasted == before.wasted + ARENA_MIN_BLOCK_SIZE - 3000);
+    arena_free(&a);
+    assert(after->live == before.live && after->peak >= before.live + 3*ARENA_MIN_BLOCK_SIZE);
+    mem_stats.enabled = enabled;
+}
+
+void run_tests()
+{
+    //BUFFER TEST
+    test_small_buf();
+    test_mem_tracking();
+
+    //ARENA TEST
+    test_arena(0);
+    test_arena(ARENA_POPULATE | ARENA_HUGE_PAGES);
+
+    //LEXER KERNEL TEST
+    test_lex_kernels(&lex_simd);
+#if LEX_SIMD_X86
+    test_lex_kernels(&lex_kernels_sse2);
+#endif
+    //INTERN TEST
+    char name[] = "foo_bar";
+    assert(str_intern(name) == str_intern("foo_bar"));
+    assert(str_intern_range(name, name + 3) == str_intern("foo"));
+    assert(str_intern("foo") != str_intern("foo_bar"));
+    for(int i = 0; i < 5000; i++)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "name%d", i);
+        assert(str_intern(buf) == str_intern(buf));
+    }
+    assert(str_intern("name42") == str_intern("name42"));
+    assert(str_intern("struct") == struct_keyword);
+    assert(is_keyword_name(return_keyword) && !is_keyword_name(str_intern("foo")));
+    for(int i = 0; i < NUM_KEYWORDS; i++)
+    {
+        assert(intern_id(keywords[i]) == i);
+        assert(keyword_lookup(keywords[i], strlen(keywords[i])) == keywords[i]);
+    }
+    assert(keyword_lookup("structs", 7) == NULL);
+
     //INT test
     char* source = "0 2158 0xffffff 0o12 0b1010";
     init_lex(source);
@@ -36,12 +787,40 @@ int main(int argc, char **argv)
     assert_token_int(10);
     assert_token_eof();
 
+    init_lex("123456789 1_000_000 18446744073709551615 0xDEADbeef01234567 0b10110010101100101 0o777 0xFFFFFFFF");
+    assert_token_int(123456789);
+    assert_token_int(1000000);
+    assert_token_int(18446744073709551615ull);
+    assert_token_int(0xDEADbeef01234567ull);
+    assert_token_int(0x16565);
+    assert_token_int(0777);
+    assert_token_int(0xFFFFFFFF);
+    assert_token_eof();
+
     //FLOAT TEST
     init_lex("3.14 .12 42.");
     assert_token_float(3.14);
     assert_token_float(.12);
     assert_token_float(42.);
     assert_token_eof();
+    init_lex("1e10 2.5e-3 123456789012345678901234567890.5 0.1 1_000.25 x.y");
+    assert_token_float(1e10);
+    assert_token_float(2.5e-3);
+    assert_token_float(123456789012345678901234567890.5);
+    assert_token_float(0.1);
+    assert_token_float(1000.25);
+    assert(match_token(TOKEN_NAME) && match_token(TOKEN_DOT) && match_token(TOKEN_NAME));
+    u64 seed = 88172645463325252ull;
+    for(int i = 0; i < 10000; i++)
+    {
+        char text[64];
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        snprintf(text, sizeof(text), "%llu.%llue%d", (unsigned long long)(seed % 100000000000ull), (unsigned long long)(seed >> 40), (int)(seed % 61) - 30);
+        init_lex(text);
+        assert(is_token(TOKEN_FLOAT) && tok.float_val == strtod(text, NULL));
+    }
 
     //CHAR TEST
     init_lex(" 'a' '\\n'");
@@ -53,11 +832,133 @@ int main(int argc, char **argv)
     init_lex(" \"Hi\"");
     assert_token_str("Hi");
     assert_token_eof();
+    init_lex("\"a\\tb\\\"c\\\\\" \"two\nlines\" \"\"");
+    assert_token_str("a\tb\"c\\");
+    assert_token_str("two\nlines");
+    assert_token_str("");
+    assert_token_eof();
+    error_count = 0;
+    char unterminated[] = "\"a\\n\0\"@@@";
+    init_lex(unterminated);
+    assert_token_str("a\n");
+    assert_token_eof();
+    assert(error_count == 1 && buf_len(diagnostics) == 1);
+    assert(strcmp(diagnostics[0].msg, "Unexpected end of file within string literal") == 0);
+    diagnostics_free(&diagnostics);
+    error_count = 0;
 
     //Keyword test
     init_lex("struct");
     assert(tok.type == TOKEN_KEYWORD);
     assert(tok.name == struct_keyword);
+    init_lex("returns in_ fn");
+    assert(is_name(str_intern("returns")) && match_token(TOKEN_NAME));
+    assert(is_name(str_intern("in_")) && match_token(TOKEN_NAME));
+    assert(is_keyword(fn_keyword));
+    init_lex("  \n\n// comment\n   some_long_identifier_name  \t\n 123456789012345678 ");
+    assert(is_name(str_intern("some_long_identifier_name")) && source_map_lookup(token_pos()).line == 4);
+    assert(source_map_lookup(token_pos()).col == 4);
+    assert(peek_token(1) == TOKEN_INT && peek_token(2) == TOKEN_EOF && peek_token(9) == TOKEN_EOF);
+    next_token();
+    assert(source_map_lookup(token_pos()).line == 5 && source_map_lookup(token_pos()).col == 2);
+    assert_token_int(123456789012345678ull);
+    assert_token_eof();
+
+    //SOURCE FILE TEST
+    {
+        char path[] = "/tmp/uct_test_XXXXXX";
+        int fd = mkstemp(path);
+        assert(fd >= 0);
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        char* text = malloc(page);
+        memset(text, ' ', page);
+        memcpy(text + page - 4, "end1", 4);
+        assert(write(fd, text, page) == (ssize_t)page);
+        close(fd);
+        source_file file;
+        assert(source_load(&file, path));
+        assert(file.len == page && file.text[page] == '\0');
+        init_lex(file.text);
+        assert(is_name(str_intern("end1")));
+        next_token();
+        assert_token_eof();
+        source_unload(&file);
+        unlink(path);
+        free(text);
+        assert(!source_load(&file, "/nonexistent/file.uct"));
+    }
+
+    //THREADED LEX TEST
+    {
+        pthread_t threads[4];
+        const char* names[4][100];
+        for(int i = 0; i < 4; i++)
+        {
+            pthread_create(&threads[i], NULL, test_lex_thread, names[i]);
+        }
+        for(int i = 0; i < 4; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        for(int i = 0; i < 100; i++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "shared_%d", i);
+            for(int j = 0; j < 4; j++)
+            {
+                assert(names[j][i] == str_intern(name));
+            }
+        }
+    }
+
+    //TOKEN BUFFER TEST
+    token_buffer tokens = {0};
+    tokenize_file(&tokens, "<test>", "let x = 'a' + 1.5;");
+    assert(buf_len(tokens.kinds) == 8 && buf_len(tokens.values) == 4);
+    assert(tokens.kinds[3] == TOKEN_INT && tokens.offsets[3] == 8);
+    for(int run = 0; run < 2; run++)
+    {
+        init_parse_tokens(&tokens);
+        assert(match_keyword(let_keyword));
+        assert(is_name(str_intern("x")) && match_token(TOKEN_NAME));
+        assert(match_token(TOKEN_ASSIGN));
+        assert(tok.mod == MOD_CHAR);
+        assert_token_int('a');
+        assert(match_token(TOKEN_ADD));
+        assert_token_float(1.5);
+        assert(match_token(TOKEN_SEMICOLON));
+        assert_token_eof();
+    }
+    token_buffer_free(&tokens);
+
 
+    test_parse();
+    test_ast_walk();
+    test_resolve();
+    test_check();
+    test_ast_cache();
+    test_driver();
+    test_bench_generate();
+}
+
+int main(int argc, char **argv)
+{
+    init_mem_tracking();
+    init_keywords();
+    init_lex_simd();
+    init_binding_powers();
+    if(argc > 1 && strcmp(argv[1], "parse") == 0)
+    {
+        return parse_main(argc - 2, argv + 2, false);
+    }
+    if(argc > 1 && strcmp(argv[1], "check") == 0)
+    {
+        return parse_main(argc - 2, argv + 2, true);
+    }
+    if(argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        return bench_main(argc - 2, argv + 2);
+    }
+    run_tests();
     return 0;
 }
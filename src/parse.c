@@ -1,45 +1,112 @@
+#undef MEM_TAG
+#define MEM_TAG MEM_AST
+
 decl* parse_decl_opt();
 decl* parse_decl();
+s_block* func_decl_body(decl* d);
 typespec* parse_type();
 stmt* parse_stmt();
 expr* parse_expr();
 
-typespec* parse_type_function()
+// Skip function bodies at parse time and parse them on first use through
+// func_decl_body. Useful for dependencies where only signatures matter.
+bool parse_lazy_bodies;
+
+// Child lists are built on a per-thread scratch stack and copied into the AST
+// arena once complete. Nested lists are pushed above the one being built and
+// popped before its next element, so every open list stays contiguous.
+#undef MEM_TAG
+#define MEM_TAG MEM_SCRATCH
+
+_Thread_local char* parse_scratch;
+
+size_t scratch_begin()
 {
-	typespec** args = NULL;
+	// Never hand out offsets into a NULL buffer, even for empty lists.
+	buf_fit(parse_scratch, 1);
+	return buf_len(parse_scratch);
+}
+
+// Lists of different element types share the stack, so each list is padded
+// up to its element's alignment and can be read in place. A list's start is
+// the top before that padding, which is where it's popped back to.
+void* scratch_alloc(size_t size, size_t align)
+{
+	size_t len = ALIGN_UP(buf_len(parse_scratch), align);
+	buf_fit(parse_scratch, len + size);
+	buf__hdr(parse_scratch)->len = len + size;
+	return parse_scratch + len;
+}
+
+size_t scratch__first(size_t start, size_t align)
+{
+	return MIN(ALIGN_UP(start, align), buf_len(parse_scratch));
+}
+
+// value is evaluated before the slot is taken, it may push lists of its own.
+#define scratch_push(T, value) do { T scratch_value = (value); memcpy(scratch_alloc(sizeof(T), _Alignof(T)), &scratch_value, sizeof(T)); } while(0)
+#define scratch_list(start, T) ((T*)(parse_scratch + scratch__first((start), _Alignof(T))))
+#define scratch_count(start, T) ((buf_len(parse_scratch) - scratch__first((start), _Alignof(T)))/sizeof(T))
+#define scratch_end(start, T) ((T*)scratch__end((start), _Alignof(T)))
+
+void scratch_pop(size_t start)
+{
+	buf__hdr(parse_scratch)->len = start;
+}
+
+void* scratch__end(size_t start, size_t align)
+{
+	size_t first = scratch__first(start, align);
+	void* list = ast_dup(parse_scratch + first, buf_len(parse_scratch) - first);
+	scratch_pop(start);
+	return list;
+}
+
+#undef MEM_TAG
+#define MEM_TAG MEM_AST
+
+typespec* parse_type_function(u32 pos)
+{
+	size_t args = scratch_begin();
 	expect_token(TOKEN_LPAREN);
 	if(!is_token(TOKEN_RPAREN))
 	{
-		buf_push(args, parse_type());
+		scratch_push(typespec*, parse_type());
 		while(match_token(TOKEN_COMMA))
 		{
-			buf_push(args, parse_type());
+			scratch_push(typespec*, parse_type());
 		}
 	}
 	expect_token(TOKEN_RPAREN);
-	typespec** rets = NULL;
+	size_t num_args = scratch_count(args, typespec*);
+	size_t rets = scratch_begin();
 	if(match_token(TOKEN_COLON))
 	{
-		buf_push(rets, parse_type());
+		scratch_push(typespec*, parse_type());
 		while(match_token(TOKEN_COMMA))
 		{
-			buf_push(rets, parse_type());
+			scratch_push(typespec*, parse_type());
 		}
 	}
-	return typespec_func(ast_dup(args, buf_sizeof(args)), buf_len(args), ast_dup(rets, buf_sizeof(rets)), buf_len(rets));
+	// typespec_func copies the lists into the canonical node if it's new, so
+	// they can be passed straight off the scratch stack.
+	typespec* type = typespec_func(pos, scratch_list(args, typespec*), num_args, scratch_list(rets, typespec*), scratch_count(rets, typespec*));
+	scratch_pop(args);
+	return type;
 }
 
 typespec* parse_type_base()
 {
+	u32 pos = token_pos();
 	if(is_token(TOKEN_NAME))
 	{
 		const char* name = tok.name;
 		next_token();
-		return typespec_name(name);
+		return typespec_name(pos, name);
 	}
 	else if(match_keyword(fn_keyword))
 	{
-		return parse_type_function();
+		return parse_type_function(pos);
 	}
 	else if(match_token(TOKEN_LPAREN))
 	{
@@ -47,8 +114,8 @@ typespec* parse_type_base()
 		expect_token(TOKEN_RPAREN);
 		return type;
 	}
-	fatal_syntax_error("Unexpected token %s in type", token_info());
-	return NULL;
+	syntax_error("Unexpected token %s in type", token_info());
+	return typespec_new(pos, TYPESPEC_NONE);
 }
 
 typespec* parse_type()
@@ -56,6 +123,7 @@ typespec* parse_type()
 	typespec* type = parse_type_base();
 	while(is_token(TOKEN_LBRACKET) || is_token(TOKEN_HAT))
 	{
+		u32 pos = token_pos();
 		if(match_token(TOKEN_LBRACKET))
 		{
 			expr* expr = NULL;
@@ -64,53 +132,55 @@ typespec* parse_type()
 				expr = parse_expr();
 			}
 			expect_token(TOKEN_RBRACKET);
-			type = typespec_array(type, expr);
+			type = typespec_array(pos, type, expr);
 		}
 		else
 		{
 			assert(is_token(TOKEN_HAT));
 			next_token();
-			type = typespec_ptr(type);
+			type = typespec_ptr(pos, type);
 		}
 	}
 	return type;
 }
 
-expr* parse_expr_compound(typespec* type)
+expr* parse_expr_compound(u32 pos, typespec* type)
 {
 	expect_token(TOKEN_LBRACE);
-	expr** args = NULL;
+	size_t args = scratch_begin();
 	if(!is_token(TOKEN_RBRACE))
 	{
-		buf_push(args, parse_expr());
+		scratch_push(expr_ref, ast_ref(parse_expr()));
 		while(match_token(TOKEN_COMMA))
 		{
-			buf_push(args, parse_expr());
+			scratch_push(expr_ref, ast_ref(parse_expr()));
 		}
 	}
 	expect_token(TOKEN_RBRACE);
-	return expr_compound(type, ast_dup(args, buf_sizeof(args)), buf_len(args));
+	size_t num_args = scratch_count(args, expr_ref);
+	return expr_compound(pos, type, scratch_end(args, expr_ref), num_args);
 }
 
 expr* parse_expr_operand()
 {
+	u32 pos = token_pos();
 	if(is_token(TOKEN_INT))
 	{
 		u64 val = tok.int_val;
 		next_token();
-		return expr_int(val);
+		return expr_int(pos, val);
 	}
 	else if(is_token(TOKEN_FLOAT))
 	{
 		f64 val = tok.float_val;
 		next_token();
-		return expr_float(val);
+		return expr_float(pos, val);
 	}
 	else if(is_token(TOKEN_STR))
 	{
 		const char* val = tok.str_val;
 		next_token();
-		return expr_str(val);
+		return expr_str(pos, val);
 	}
 	else if(is_token(TOKEN_NAME))
 	{
@@ -118,21 +188,21 @@ expr* parse_expr_operand()
 		next_token();
 		if(is_token(TOKEN_LBRACE))
 		{
-			return parse_expr_compound(typespec_name(name));
+			return parse_expr_compound(pos, typespec_name(pos, name));
 		}
-		return expr_name(name);
+		return expr_name(pos, name);
 	}
 	else if(is_token(TOKEN_LBRACE))
 	{
-		return parse_expr_compound(NULL);
+		return parse_expr_compound(pos, NULL);
 	}
-	else if(is_token(TOKEN_LPAREN))
+	else if(match_token(TOKEN_LPAREN))
 	{
 		if(match_token(TOKEN_COLON))
 		{
 			typespec* type = parse_type();
 			expect_token(TOKEN_RPAREN);
-			return parse_expr_compound(type);
+			return parse_expr_compound(pos, type);
 		}
 		else
 		{
@@ -144,7 +214,7 @@ expr* parse_expr_operand()
 	else
 	{
 		syntax_error("Unexpected token %s in expression", token_info());
-		return NULL;
+		return expr_new(pos, EXPR_NONE);
 	}
 }
 
@@ -153,32 +223,34 @@ expr* parse_expr_base()
 	expr* exp = parse_expr_operand();
 	while(is_token(TOKEN_LPAREN) || is_token(TOKEN_LBRACKET) || is_token(TOKEN_DOT))
 	{
+		u32 pos = token_pos();
 		if(match_token(TOKEN_LPAREN))
 		{
-			expr** args = NULL;
+			size_t args = scratch_begin();
 			if(!is_token(TOKEN_RPAREN))
 			{
-				buf_push(args, parse_expr());
+				scratch_push(expr_ref, ast_ref(parse_expr()));
 				while(match_token(TOKEN_COMMA))
 				{
-					buf_push(args, parse_expr());
+					scratch_push(expr_ref, ast_ref(parse_expr()));
 				}
 			}
 			expect_token(TOKEN_RPAREN);
-			exp = expr_call(exp, ast_dup(args, buf_sizeof(args)), buf_len(args));
+			size_t num_args = scratch_count(args, expr_ref);
+			exp = expr_call(pos, exp, scratch_end(args, expr_ref), num_args);
 		}
-		if(match_token(TOKEN_LBRACKET))
+		else if(match_token(TOKEN_LBRACKET))
 		{
 			 expr* index = parse_expr();
 			 expect_token(TOKEN_RBRACKET);
-			 exp = expr_index(exp, index);
+			 exp = expr_index(pos, exp, index);
 		}
 		else
 		{
 			next_token();
 			const char* field = tok.name;
 			expect_token(TOKEN_NAME);
-			exp = expr_field(exp, field);
+			exp = expr_field(pos, exp, field);
 		}
 	}
 
@@ -187,135 +259,215 @@ expr* parse_expr_base()
 
 bool is_unary_op()
 {
-	return is_token(TOKEN_ADD) || is_token(TOKEN_SUB) || is_token(TOKEN_MUL) || is_token(TOKEN_AND);
+	return is_token(TOKEN_ADD) || is_token(TOKEN_SUB) || is_token(TOKEN_MUL) || is_token(TOKEN_AND) || is_token(TOKEN_NOT) || is_token(TOKEN_NEG);
 }
 
 expr* parse_expr_unary()
 {
 	if(is_unary_op())
 	{
+		u32 pos = token_pos();
 		token_type op = tok.type;
 		next_token();
-		return expr_unary(op, parse_expr_unary());
+		return expr_unary(pos, op, parse_expr_unary());
 	}
 	return parse_expr_base();
 }
 
-bool is_mul_op()
+// Binding power of every token that can continue an expression, zero for the
+// rest. Binary operators are left-associative, the ternary right-associative.
+typedef enum
 {
-	return TOKEN_FIRST_MUL <= tok.type && tok.type <= TOKEN_LAST_MUL;
-}
+	POWER_NONE,
+	POWER_TERNARY,
+	POWER_OR,
+	POWER_AND,
+	POWER_CMP,
+	POWER_ADD,
+	POWER_MUL,
+} binding_power;
 
-expr* parse_expr_mul()
+u8 binding_powers[NUM_TOKEN_KINDS];
+
+void init_binding_powers()
 {
-	expr* expr = parse_expr_unary();
-	while(is_mul_op)
+	for(token_type type = TOKEN_FIRST_MUL; type <= TOKEN_LAST_MUL; type++)
 	{
-		token_type op = tok.type;
-		next_token();
-		expr = expr_binary(op, expr, parse_expr_unary());
+		binding_powers[type] = POWER_MUL;
 	}
-	return expr;
-}
-
-bool is_add_op()
-{
-	return TOKEN_FIRST_ADD <= tok.type && tok.type <= TOKEN_LAST_ADD;
+	for(token_type type = TOKEN_FIRST_ADD; type <= TOKEN_LAST_ADD; type++)
+	{
+		binding_powers[type] = POWER_ADD;
+	}
+	for(token_type type = TOKEN_FIRST_CMP; type <= TOKEN_LAST_CMP; type++)
+	{
+		binding_powers[type] = POWER_CMP;
+	}
+	binding_powers[TOKEN_AND_AND] = POWER_AND;
+	binding_powers[TOKEN_OR_OR] = POWER_OR;
+	binding_powers[TOKEN_QUESTION] = POWER_TERNARY;
 }
 
-expr* parse_expr_add()
+// Parses an expression whose operators all bind tighter than min_power.
+expr* parse_expr_binary(binding_power min_power)
 {
-	expr* expr = parse_expr_mul();
-	while(is_add_op())
+	expr* exp = parse_expr_unary();
+	binding_power power;
+	while((power = binding_powers[tok.type]) > min_power)
 	{
+		u32 pos = token_pos();
 		token_type op = tok.type;
 		next_token();
-		expr = expr_binary(op, expr, parse_expr_mul());
+		if(op == TOKEN_QUESTION)
+		{
+			expr* then_expr = parse_expr_binary(POWER_NONE);
+			expect_token(TOKEN_COLON);
+			expr* else_expr = parse_expr_binary(POWER_NONE);
+			exp = expr_ternary(pos, exp, then_expr, else_expr);
+		}
+		else
+		{
+			exp = expr_binary(pos, op, exp, parse_expr_binary(power));
+		}
 	}
-	return expr;
+	return exp;
 }
 
-bool is_cmp_op()
+expr* parse_expr()
 {
-	return TOKEN_FIRST_CMP <= tok.type && tok.type <= TOKEN_LAST_CMP;
+	return parse_expr_binary(POWER_NONE);
 }
 
-expr* parse_expr_cmp()
+bool is_decl_keyword()
 {
-	expr* expr = parse_expr_add();
-	while(is_cmp_op())
+	return is_token(TOKEN_KEYWORD) && intern_id(tok.name) <= KEYWORD_CONST;
+}
+
+bool is_stmt_keyword()
+{
+	if(!is_token(TOKEN_KEYWORD))
 	{
-		token_type op = tok.type;
-		next_token();
-		expr = expr_binary(op, expr, parse_expr_add());
+		return false;
+	}
+	switch(intern_id(tok.name))
+	{
+	case KEYWORD_IF: case KEYWORD_FOR: case KEYWORD_WHILE: case KEYWORD_SWITCH:
+	case KEYWORD_BREAK: case KEYWORD_CONTINUE: case KEYWORD_RETURN:
+		return true;
+	default:
+		return is_decl_keyword();
 	}
-	return expr;
 }
 
-expr* parse_expr_and()
+// Skips a token, or a whole block so that nested statements and braces don't
+// look like places to resume at.
+void skip_sync_token()
 {
-	expr* expr = parse_expr_cmp();
-	while(match_token(TOKEN_AND_AND))
+	if(is_token(TOKEN_LBRACE))
 	{
-		expr = expr_binary(TOKEN_AND_AND, expr, parse_expr_cmp());
+		skip_token_block();
+	}
+	else
+	{
+		next_token();
 	}
-	return expr;
 }
 
-expr* parse_expr_or()
+// True if whatever started at token start ran up to a ; or }, in which case
+// the parser is already back in step.
+bool synced_at_boundary(u32 start)
 {
-	expr* expr = parse_expr_and();
-	while(match_token(TOKEN_OR_OR))
+	if(cursor.pos == start)
 	{
-		expr = expr_binary(TOKEN_OR_OR, expr, parse_expr_and());
+		return false;
 	}
-	return expr;
+	token_type last = cursor.tokens->kinds[cursor.pos - 1];
+	return last == TOKEN_SEMICOLON || last == TOKEN_RBRACE;
 }
 
-expr* parse_expr_ternary()
+// Panic-mode recovery for statements and aggregate items: skip past the next
+// ;, or up to the enclosing } or the next statement keyword. At least one token
+// is always consumed, so a loop calling this makes progress.
+void sync_stmt(u32 start)
 {
-	expr* exp = parse_expr_or();
-	if(match_token(TOKEN_QUESTION))
+	if(!parse_panic)
 	{
-		expr* then_expr = parse_expr_ternary();
-		expect_token(TOKEN_COLON);
-		expr* else_expr = parse_expr_ternary();
-		exp = expr_ternary(exp, then_expr, else_expr);
+		return;
+	}
+	parse_panic = false;
+	if(synced_at_boundary(start))
+	{
+		return;
+	}
+	if(cursor.pos == start && !is_token(TOKEN_RBRACE) && !is_token_eof())
+	{
+		skip_sync_token();
+	}
+	while(!is_token_eof() && !is_token(TOKEN_RBRACE) && !is_stmt_keyword())
+	{
+		if(match_token(TOKEN_SEMICOLON))
+		{
+			break;
+		}
+		skip_sync_token();
 	}
-	return exp;
 }
 
-expr* parse_expr()
+// Panic-mode recovery at file scope: skip ahead to the next declaration.
+void sync_decl(u32 start)
 {
-	parse_expr_ternary();
+	if(!parse_panic)
+	{
+		return;
+	}
+	parse_panic = false;
+	if(synced_at_boundary(start))
+	{
+		return;
+	}
+	if(cursor.pos == start && !is_token_eof())
+	{
+		skip_sync_token();
+	}
+	while(!is_token_eof() && !is_decl_keyword())
+	{
+		skip_sync_token();
+	}
 }
 
 expr* parse_paren_expr()
 {
 	expect_token(TOKEN_LPAREN);
 	expr* expr = parse_expr();
-	expect_token(TOKEN_LPAREN);
+	expect_token(TOKEN_RPAREN);
 	return expr;
 }
 
 s_block parse_stmt_block()
 {
-	expect_token(TOKEN_LBRACE);
-	stmt** stmts = NULL;
+	// Without the { any } ahead belongs to an enclosing block, so leave it.
+	if(!expect_token(TOKEN_LBRACE))
+	{
+		return (s_block){0};
+	}
+	size_t stmts = scratch_begin();
 	while(!is_token_eof() && !is_token(TOKEN_RBRACE))
 	{
-		buf_push(stmts, parse_stmt());
+		u32 start = cursor.pos;
+		scratch_push(stmt_ref, ast_ref(parse_stmt()));
+		sync_stmt(start);
 	}
 	expect_token(TOKEN_RBRACE);
-	return (s_block){ast_dup(stmts, buf_sizeof(stmts)), buf_len(stmts)};
+	size_t num_stmts = scratch_count(stmts, stmt_ref);
+	return (s_block){scratch_end(stmts, stmt_ref), num_stmts};
 }
 
-stmt* parse_stmt_if()
+stmt* parse_stmt_if(u32 pos)
 {
 	expr* cond = parse_paren_expr();
 	s_block then_block = parse_stmt_block();
 	s_block else_block = {0};
-	else_if* elseifs = NULL;
+	size_t elseifs = scratch_begin();
 	while(match_keyword(else_keyword))
 	{
 		if(!match_keyword(if_keyword))
@@ -325,15 +477,16 @@ stmt* parse_stmt_if()
 		}
 		expr* elseif_cond = parse_paren_expr();
 		s_block elseif_block = parse_stmt_block();
-		buf_push(elseifs, (else_if){elseif_cond, elseif_block});
+		scratch_push(else_if, ((else_if){ast_ref(elseif_cond), elseif_block}));
 	}
-	return stmt_if(cond, then_block, ast_dup(elseifs, buf_sizeof(elseifs)), buf_len(elseifs), else_block);
+	size_t num_elseifs = scratch_count(elseifs, else_if);
+	return stmt_if(pos, cond, then_block, scratch_end(elseifs, else_if), num_elseifs, else_block);
 }
 
-stmt* parse_stmt_while()
+stmt* parse_stmt_while(u32 pos)
 {
 	expr* cond = parse_paren_expr();
-	return stmt_while(cond, parse_stmt_block());
+	return stmt_while(pos, cond, parse_stmt_block());
 }
 
 bool is_assign_op()
@@ -343,38 +496,43 @@ bool is_assign_op()
 
 stmt* parse_simple_stmt()
 {
+	u32 pos = token_pos();
 	expr* exp = parse_expr();
 	stmt* stmt;
 	if(match_token(TOKEN_COLON_ASSIGN))
 	{
-		if(exp->type != EXPR_NAME)
+		expr* init = parse_expr();
+		if(exp->type == EXPR_NAME)
+		{
+			stmt = stmt_init(pos, exp->name, init);
+		}
+		else
 		{
-			fatal_syntax_error(":= must be preceded by a name");
-			return NULL;
+			error_at(pos, ":= must be preceded by a name");
+			stmt = stmt_assign(pos, TOKEN_ASSIGN, exp, init);
 		}
-		stmt = stmt_init(exp->name, parse_expr());
 	}
 	else if(is_assign_op())
 	{
 		token_type op = tok.type;
 		next_token();
-		stmt = stmt_assign(op, exp, parse_expr());
+		stmt = stmt_assign(pos, op, exp, parse_expr());
 	}
 	else if(is_token(TOKEN_INC) || is_token(TOKEN_DEC))
 	{
 		token_type op = tok.type;
 		next_token();
-		stmt = stmt_assign(op, exp, NULL);
+		stmt = stmt_assign(pos, op, exp, NULL);
 	}
 	else
 	{
-		stmt = stmt_expr(exp);
+		stmt = stmt_expr(pos, exp);
 	}
 
 	return stmt;
 }
 
-stmt* parse_stmt_for()
+stmt* parse_stmt_for(u32 pos)
 {
 	expect_token(TOKEN_LPAREN);
 	stmt* init = NULL;
@@ -395,82 +553,92 @@ stmt* parse_stmt_for()
 		next = parse_simple_stmt();
 		if(next->type == STMT_INIT)
 		{
-			syntax_error("Init statements not allowed in for-statement's next clause");
+			error_at(next->pos, "Init statements not allowed in for-statement's next clause");
 		}
 	}
 	expect_token(TOKEN_RPAREN);
-	return stmt_for(init, cond, next, parse_stmt_block());
+	return stmt_for(pos, init, cond, next, parse_stmt_block());
 }
 
 switch_case parse_stmt_switch_case()
 {
-	expr** exprs = NULL;
+	size_t exprs = scratch_begin();
 	bool is_default = false;
 	while(is_token(TOKEN_ARROW) || is_token(TOKEN_UNDERSCORE))
 	{
 		if(match_token(TOKEN_ARROW))
 		{
-			buf_push(exprs, parse_expr());
+			scratch_push(expr_ref, ast_ref(parse_expr()));
 		}
 		else
 		{
 			next_token();
 			if(is_default)
 			{
-				syntax_error("Duplicate default labels in switch case");
+				error("Duplicate default labels in switch case");
 			}
 			is_default = true;
 		}
 	}
-	stmt** stmts = NULL;
+	size_t num_exprs = scratch_count(exprs, expr_ref);
+	size_t stmts = scratch_begin();
 	while(!is_token_eof() && !is_token(TOKEN_RBRACE) && !is_token(TOKEN_ARROW) && !is_token(TOKEN_UNDERSCORE))
 	{
-		buf_push(stmts, parse_stmt());
+		u32 start = cursor.pos;
+		scratch_push(stmt_ref, ast_ref(parse_stmt()));
+		sync_stmt(start);
 	}
-	s_block block = {ast_dup(stmts, buf_sizeof(stmts)), buf_len(stmts)};
-	return (switch_case){ast_dup(exprs, buf_sizeof(exprs)), buf_len(exprs), is_default, block};
+	size_t num_stmts = scratch_count(stmts, stmt_ref);
+	s_block block = {scratch_end(stmts, stmt_ref), num_stmts};
+	return (switch_case){scratch_end(exprs, expr_ref), num_exprs, is_default, block};
 }
 
-stmt* parse_stmt_switch()
+stmt* parse_stmt_switch(u32 pos)
 {
 	expr* expr = parse_paren_expr();
-	switch_case *cases = NULL;
+	size_t cases = scratch_begin();
 	expect_token(TOKEN_LBRACE);
 	while(!is_token_eof() && !is_token(TOKEN_RBRACE))
 	{
-		buf_push(cases, parse_stmt_switch_case());
+		scratch_push(switch_case, parse_stmt_switch_case());
 	}
 	expect_token(TOKEN_RBRACE);
-	return stmt_switch(expr, ast_dup(cases, buf_sizeof(cases)), buf_len(cases));
+	size_t num_cases = scratch_count(cases, switch_case);
+	return stmt_switch(pos, expr, scratch_end(cases, switch_case), num_cases);
 }
 
 stmt* parse_stmt()
 {
+	u32 pos = token_pos();
 	if(match_keyword(if_keyword))
 	{
-		return parse_stmt_if();
+		return parse_stmt_if(pos);
 	}
 	else if(match_keyword(while_keyword))
 	{
-		return parse_stmt_while();
+		return parse_stmt_while(pos);
 	}
 	else if(match_keyword(for_keyword))
 	{
-		return parse_stmt_for();
+		return parse_stmt_for(pos);
+	}
+	else if(match_keyword(switch_keyword))
+	{
+		return parse_stmt_switch(pos);
 	}
 	else if(is_token(TOKEN_LBRACE))
 	{
-		return stmt_block(parse_stmt_block());
+		return stmt_block(pos, parse_stmt_block());
 	}
 	else if(match_keyword(break_keyword))
 	{
 		expect_token(TOKEN_SEMICOLON);
-		return stmt_break();
+		return stmt_break(pos);
 	}
 	else if(match_keyword(continue_keyword))
 	{
 		expect_token(TOKEN_SEMICOLON);
-		return stmt_continue();
+		return stmt_continue(pos);
 	}
 	else if(match_keyword(return_keyword))
 	{
@@ -480,14 +648,14 @@ stmt* parse_stmt()
 			expr = parse_expr();
 		}
 		expect_token(TOKEN_SEMICOLON);
-		return stmt_return(expr);
+		return stmt_return(pos, expr);
 	}
 	else
 	{
 		decl* decl = parse_decl_opt();
 		if(decl)
 		{
-			return stmt_decl(decl);
+			return stmt_decl(pos, decl);
 		}
 		stmt* stmt = parse_simple_stmt();
 		expect_token(TOKEN_SEMICOLON);
@@ -514,26 +682,27 @@ enum_item parse_decl_enum_item()
 }
 
 //TODO: Figure out if I want enums and errs to be different
-decl* parse_decl_enum()
+decl* parse_decl_enum(u32 pos)
 {
 	const char* name = parse_name();
 	expect_token(TOKEN_LBRACE);
-	enum_item* items = NULL;
-	if(!is_token(TOKEN_RBRACE))
+	size_t items = scratch_begin();
+	while(!is_token_eof() && !is_token(TOKEN_RBRACE))
 	{
-		buf_push(items, parse_decl_enum_item());
-		while(match_token(TOKEN_COMMA))
+		scratch_push(enum_item, parse_decl_enum_item());
+		if(!match_token(TOKEN_COMMA) && !match_token(TOKEN_SEMICOLON))
 		{
-			buf_push(items, parse_decl_enum_item());
+			break;
 		}
 	}
 	expect_token(TOKEN_RBRACE);
-	return decl_enum(name, ast_dup(items, buf_sizeof(items)), buf_len(items));
+	size_t num_items = scratch_count(items, enum_item);
+	return decl_enum(pos, name, scratch_end(items, enum_item), num_items);
 }
 
 aggregate_item parse_decl_aggregate_item()
 {
-	const char* name = NULL;
+	const char* name = parse_name();
 	expect_token(TOKEN_COLON);
 	typespec* type = parse_type();
 	expr* init = NULL;
@@ -545,49 +714,60 @@ aggregate_item parse_decl_aggregate_item()
 	return (aggregate_item){name, type, init};
 }
 
-decl* parse_decl_aggregate(decl_type type)
+decl* parse_decl_aggregate(u32 pos, decl_type type)
 {
 	assert(type == DECL_STRUCT || type == DECL_UNION);
 	const char* name = parse_name();
 	expect_token(TOKEN_LBRACE);
-	aggregate_item* items = NULL;
+	size_t items = scratch_begin();
 	while(!is_token_eof() && !is_token(TOKEN_RBRACE))
 	{
-		buf_push(items, parse_decl_aggregate_item());
+		u32 start = cursor.pos;
+		scratch_push(aggregate_item, parse_decl_aggregate_item());
+		sync_stmt(start);
 	}
 	expect_token(TOKEN_RBRACE);
-	return decl_aggregate(type, name, ast_dup(items, buf_sizeof(items)), buf_len(items));
+	size_t num_items = scratch_count(items, aggregate_item);
+	return decl_aggregate(pos, type, name, scratch_end(items, aggregate_item), num_items);
 }
 
-decl* parse_decl_var()
+decl* parse_decl_var(u32 pos)
 {
 	const char* name = parse_name();
-	if(match_token(TOKEN_ASSIGN))
+	typespec* type = NULL;
+	expr* expr = NULL;
+	if(match_token(TOKEN_ASSIGN) || match_token(TOKEN_COLON_ASSIGN))
 	{
-		return decl_var(name, NULL, parse_expr());
+		expr = parse_expr();
 	}
 	else if(match_token(TOKEN_COLON))
 	{
-		typespec* type = parse_type();
-		expr* expr = NULL;
+		type = parse_type();
 		if(match_token(TOKEN_ASSIGN))
 		{
 			expr = parse_expr();
 		}
-		return decl_var(name, type, expr);
 	}
 	else
 	{
-		fatal_syntax_error("Expected : or = after let, got %s", token_info());
-		return NULL;
+		syntax_error("Expected : or = after let, got %s", token_info());
 	}
+	expect_token(TOKEN_SEMICOLON);
+	return decl_var(pos, name, type, expr);
 }
 
-decl* parse_decl_const()
+decl* parse_decl_const(u32 pos)
 {
 	const char* name = parse_name();
+	typespec* type = NULL;
+	if(match_token(TOKEN_COLON))
+	{
+		type = parse_type();
+	}
 	expect_token(TOKEN_ASSIGN);
-	return decl_const(name, parse_expr());
+	expr* expr = parse_expr();
+	expect_token(TOKEN_SEMICOLON);
+	return decl_const(pos, name, type, expr);
 }
 
 //TODO: Maybe support initial values for functions
@@ -599,60 +779,94 @@ func_item parse_decl_func_param()
 	return (func_item){name, type};
 }
 
-decl* parse_decl_func()
+decl* parse_decl_func(u32 pos)
 {
 	const char* name = parse_name();
 	expect_token(TOKEN_LPAREN);
-	func_item* params = NULL;
+	size_t params = scratch_begin();
 	if(!is_token(TOKEN_RPAREN))
 	{
-		buf_push(params, parse_decl_func_param());
-		while(match_token(TOKEN_RPAREN))
+		scratch_push(func_item, parse_decl_func_param());
+		while(match_token(TOKEN_COMMA))
 		{
-			buf_push(params, parse_decl_func_param());
+			scratch_push(func_item, parse_decl_func_param());
 		}
 	}
 	expect_token(TOKEN_RPAREN);
-	typespec** ret_types = NULL;
+	size_t num_params = scratch_count(params, func_item);
+	size_t rets = scratch_begin();
 	if(match_token(TOKEN_COLON))
 	{
-		buf_push(ret_types, parse_type());
+		scratch_push(typespec*, parse_type());
 		while(match_token(TOKEN_COMMA))
 		{
-			buf_push(ret_types, parse_type());
+			scratch_push(typespec*, parse_type());
 		}
 	}
+	size_t num_rets = scratch_count(rets, typespec*);
+	typespec** ret_types = scratch_end(rets, typespec*);
+	func_item* param_list = scratch_end(params, func_item);
+
+	s_block block = {0};
+	token_cursor body = {0};
+	if(parse_lazy_bodies && is_token(TOKEN_LBRACE))
+	{
+		body = save_cursor();
+		skip_token_block();
+	}
+	else
+	{
+		block = parse_stmt_block();
+	}
+	decl* d = decl_func(pos, name, param_list, num_params, ret_types, num_rets, block);
+	d->func_decl.body = body;
+	return d;
+}
 
-	s_block block = parse_stmt_block();
-	return decl_func(name, ast_dup(params, buf_sizeof(params)), buf_len(params), ast_dup(ret_types, buf_sizeof(ret_types)), buf_len(ret_types), block);
+// Parses a lazily skipped function body the first time it's asked for. The
+// body's token buffer and source must still be alive.
+s_block* func_decl_body(decl* d)
+{
+	assert(d->type == DECL_FUNC);
+	func_decl* func = &d->func_decl;
+	if(func->body.tokens)
+	{
+		token_cursor saved = save_cursor();
+		restore_cursor(func->body);
+		func->body = (token_cursor){0};
+		func->block = parse_stmt_block();
+		restore_cursor(saved);
+	}
+	return &func->block;
 }
 
 decl* parse_decl_opt()
 {
+	u32 pos = token_pos();
 	if(match_keyword(enum_keyword))
 	{
 		//TODO: err support
-		return parse_decl_enum();
+		return parse_decl_enum(pos);
 	}
 	else if(match_keyword(struct_keyword))
 	{
-		return parse_decl_aggregate(DECL_STRUCT);
+		return parse_decl_aggregate(pos, DECL_STRUCT);
 	}
 	else if(match_keyword(union_keyword))
 	{
-		return parse_decl_aggregate(DECL_UNION);
+		return parse_decl_aggregate(pos, DECL_UNION);
 	}
 	else if(match_keyword(let_keyword))
 	{
-		return parse_decl_var();
+		return parse_decl_var(pos);
 	}
 	else if(match_keyword(const_keyword))
 	{
-		return parse_decl_const();
+		return parse_decl_const(pos);
 	}
 	else if(match_keyword(fn_keyword))
 	{
-		return parse_decl_func();
+		return parse_decl_func(pos);
 	}
 	else
 	{
@@ -660,12 +874,16 @@ decl* parse_decl_opt()
 	}
 }
 
+// Returns NULL if there was no declaration to parse. The error has been
+// reported and the parser moved on to the next declaration keyword.
 decl* parse_decl()
 {
+	u32 start = cursor.pos;
 	decl* decl = parse_decl_opt();
 	if(!decl)
 	{
-		fatal_syntax_error("Expected declaration keyword, got %s", token_info());
+		syntax_error("Expected declaration keyword, got %s", token_info());
 	}
+	sync_decl(start);
 	return decl;
 }
@@ -0,0 +1,486 @@
+// Name resolution. Runs over a whole package once every file is parsed and
+// binds each name expression, init statement and named typespec to the symbol
+// it refers to. Globals are all entered before anything is resolved, so
+// declarations can refer to each other in any order.
+//
+// Scopes are open-addressed tables keyed by a name's intern id. Locals share
+// one table that always holds a name's innermost binding: declaring a local
+// saves the binding it shadows and leaving the scope puts those back, so a
+// lookup is a single probe however deep the scopes nest or however many
+// locals a function has.
+
+#undef MEM_TAG
+#define MEM_TAG MEM_RESOLVE
+
+typedef enum
+{
+    SYM_NONE,
+    SYM_TYPE,
+    SYM_VAR,
+    SYM_CONST,
+    SYM_FUNC,
+    SYM_PARAM,
+    SYM_LOCAL,
+} sym_kind;
+
+const char* sym_kind_names[] =
+{
+    [SYM_NONE] = "none",
+    [SYM_TYPE] = "type",
+    [SYM_VAR] = "var",
+    [SYM_CONST] = "const",
+    [SYM_FUNC] = "func",
+    [SYM_PARAM] = "param",
+    [SYM_LOCAL] = "local",
+};
+
+// decl is NULL for builtin types. Locals made by := point at their init
+// statement instead, parameters at their entry in the parameter list. type
+// and state belong to the type checker.
+struct sym
+{
+    const char* name;
+    u8 kind;
+    u8 state;
+    u32 pos;
+    Type* type;
+    union
+    {
+        decl* decl;
+        stmt* init;
+        func_item* param;
+    };
+};
+
+// key is the name's intern id plus one, so zeroed slots are empty. Keys are
+// never removed; a local whose scope has closed just leaves a NULL sym behind.
+typedef struct
+{
+    u32 key;
+    u32 depth;
+    sym* sym;
+} scope_entry;
+
+typedef struct
+{
+    scope_entry* entries;
+    size_t len;
+    size_t cap;
+} scope_table;
+
+// Resolution runs on one thread after parsing, so there's a single resolver.
+// Symbols and tables are allocated from its arena and live until the next
+// package is resolved.
+typedef struct
+{
+    arena arena;
+    scope_table globals;
+    scope_table locals;
+    // Bindings shadowed by the locals of every open scope, innermost last.
+    scope_entry* shadowed;
+    // Length of shadowed when each open scope was entered.
+    size_t* scopes;
+    ast_walker walker;
+    // Named typespecs are shared between every place they're written, so
+    // their errors are reported at the expression or declaration using them.
+    u32 pos;
+} resolver;
+
+static resolver res = {.arena.tag = MEM_RESOLVE};
+
+const char* builtin_type_names[] = {"bool", "i8", "i16", "i32", "i64", "u8", "u16", "u32", "u64", "f32", "f64"};
+
+#define SCOPE_MIN_CAP 256
+
+static scope_entry* scope_find(scope_table* table, u32 key)
+{
+    size_t i = hash_mix(key) & (table->cap - 1);
+    while(table->entries[i].key && table->entries[i].key != key)
+    {
+        i = (i + 1) & (table->cap - 1);
+    }
+    return &table->entries[i];
+}
+
+static sym* scope_get(scope_table* table, const char* name)
+{
+    return table->cap ? scope_find(table, intern_id(name) + 1)->sym : NULL;
+}
+
+// Returns the entry for name, adding an empty one if it has none yet.
+static scope_entry* scope_slot(scope_table* table, const char* name)
+{
+    if(2*table->len >= table->cap)
+    {
+        scope_table old = *table;
+        table->cap = CLAMP_MIN(2*old.cap, SCOPE_MIN_CAP);
+        table->entries = arena_alloc(&res.arena, table->cap*sizeof(scope_entry));
+        memset(table->entries, 0, table->cap*sizeof(scope_entry));
+        for(size_t i = 0; i < old.cap; i++)
+        {
+            if(old.entries[i].key)
+            {
+                *scope_find(table, old.entries[i].key) = old.entries[i];
+            }
+        }
+    }
+    u32 key = intern_id(name) + 1;
+    scope_entry* entry = scope_find(table, key);
+    if(!entry->key)
+    {
+        entry->key = key;
+        table->len++;
+    }
+    return entry;
+}
+
+static sym* sym_new(sym_kind kind, const char* name, u32 pos)
+{
+    sym* s = arena_alloc(&res.arena, sizeof(sym));
+    *s = (sym){.name = name, .kind = kind, .pos = pos};
+    return s;
+}
+
+static void declare_global(sym* s)
+{
+    scope_entry* entry = scope_slot(&res.globals, s->name);
+    if(entry->sym)
+    {
+        error_at(s->pos, "Duplicate declaration of %s", s->name);
+        return;
+    }
+    entry->sym = s;
+}
+
+static void declare_local(sym* s)
+{
+    u32 depth = (u32)buf_len(res.scopes);
+    scope_entry* entry = scope_slot(&res.locals, s->name);
+    if(entry->sym && entry->depth == depth)
+    {
+        error_at(s->pos, "Duplicate declaration of %s", s->name);
+        return;
+    }
+    buf_push(res.shadowed, *entry);
+    entry->depth = depth;
+    entry->sym = s;
+}
+
+static void push_scope()
+{
+    buf_push(res.scopes, buf_len(res.shadowed));
+}
+
+static void pop_scope()
+{
+    assert(buf_len(res.scopes));
+    size_t start = res.scopes[--buf__hdr(res.scopes)->len];
+    while(buf_len(res.shadowed) > start)
+    {
+        scope_entry old = res.shadowed[--buf__hdr(res.shadowed)->len];
+        *scope_find(&res.locals, old.key) = old;
+    }
+}
+
+// Innermost symbol called name, or NULL if nothing in scope is.
+sym* resolve_lookup(const char* name)
+{
+    sym* s = scope_get(&res.locals, name);
+    return s ? s : scope_get(&res.globals, name);
+}
+
+sym* resolve_global(const char* name)
+{
+    return scope_get(&res.globals, name);
+}
+
+static void resolve_type_name(typespec* t)
+{
+    sym* s = resolve_global(t->name);
+    if(!s)
+    {
+        error_at(res.pos, "Undeclared type %s", t->name);
+    }
+    else if(s->kind != SYM_TYPE)
+    {
+        error_at(res.pos, "%s is not a type", t->name);
+        s = NULL;
+    }
+    t->sym = s;
+}
+
+static void resolve_name(expr* e)
+{
+    e->sym = resolve_lookup(e->name);
+    if(!e->sym)
+    {
+        error_at(e->pos, "Undeclared name %s", e->name);
+    }
+}
+
+// Expressions and typespecs are walked iteratively, since a long operator
+// chain can be far deeper than the statements around it.
+static walk_action resolve_node(void* ctx, ast_node node)
+{
+    switch(node.kind)
+    {
+    case AST_TYPESPEC:
+        if(node.type->type == TYPESPEC_NAME)
+        {
+            resolve_type_name(node.type);
+        }
+        break;
+    case AST_EXPR:
+        res.pos = node.expr->pos;
+        if(node.expr->type == EXPR_NAME)
+        {
+            resolve_name(node.expr);
+        }
+        break;
+    default:
+        break;
+    }
+    return WALK_CONTINUE;
+}
+
+static void resolve_expr(expr* e)
+{
+    if(e)
+    {
+        ast_walk(&res.walker, AST_EXPR, e);
+    }
+}
+
+static void resolve_typespec(typespec* t, u32 pos)
+{
+    if(t)
+    {
+        res.pos = pos;
+        ast_walk(&res.walker, AST_TYPESPEC, t);
+    }
+}
+
+static void resolve_stmt(stmt* s);
+
+static void resolve_stmts(s_block block)
+{
+    for(size_t i = 0; i < block.num_stmts; i++)
+    {
+        resolve_stmt(stmt_at(block.stmt[i]));
+    }
+}
+
+static void resolve_block(s_block block)
+{
+    push_scope();
+    resolve_stmts(block);
+    pop_scope();
+}
+
+// Only variables and constants can be declared inside a function.
+static void resolve_local_decl(decl* d)
+{
+    switch(d->type)
+    {
+    case DECL_VAR:
+        resolve_typespec(d->var_decl.type, d->pos);
+        resolve_expr(d->var_decl.expr);
+        break;
+    case DECL_CONST:
+        resolve_typespec(d->const_decl.type, d->pos);
+        resolve_expr(d->const_decl.expr);
+        break;
+    default:
+        error_at(d->pos, "%s declarations are only allowed at file scope", decl_type_names[d->type]);
+        return;
+    }
+    d->sym = sym_new(d->type == DECL_CONST ? SYM_CONST : SYM_LOCAL, d->name, d->pos);
+    d->sym->decl = d;
+    declare_local(d->sym);
+}
+
+static void resolve_stmt(stmt* s)
+{
+    if(!s)
+    {
+        return;
+    }
+    switch(s->type)
+    {
+    case STMT_DECL:
+        resolve_local_decl(s->decl);
+        break;
+    case STMT_RETURN:
+        resolve_expr(expr_at(s->return_stmt.expr));
+        break;
+    case STMT_BLOCK:
+        resolve_block(s->block);
+        break;
+    case STMT_IF:
+        resolve_expr(expr_at(s->if_stmt.cond));
+        resolve_block(s->if_stmt.then_block);
+        for(size_t i = 0; i < s->if_stmt.num_elseifs; i++)
+        {
+            resolve_expr(expr_at(s->if_stmt.elseifs[i].cond));
+            resolve_block(s->if_stmt.elseifs[i].block);
+        }
+        resolve_block(s->if_stmt.else_block);
+        break;
+    case STMT_FOR:
+        // The init statement's locals are visible to the whole loop.
+        push_scope();
+        resolve_stmt(stmt_at(s->for_stmt.init));
+        resolve_expr(expr_at(s->for_stmt.cond));
+        resolve_stmt(stmt_at(s->for_stmt.next));
+        resolve_block(s->for_stmt.block);
+        pop_scope();
+        break;
+    case STMT_WHILE:
+        resolve_expr(expr_at(s->while_stmt.cond));
+        resolve_block(s->while_stmt.block);
+        break;
+    case STMT_SWITCH:
+        resolve_expr(expr_at(s->switch_stmt.expr));
+        for(size_t i = 0; i < s->switch_stmt.num_cases; i++)
+        {
+            switch_case* c = &s->switch_stmt.cases[i];
+            for(size_t j = 0; j < c->num_exprs; j++)
+            {
+                resolve_expr(expr_at(c->exprs[j]));
+            }
+            resolve_block(c->block);
+        }
+        break;
+    case STMT_INIT:
+        // The initializer is resolved first, so `x := x` reads an outer x.
+        resolve_expr(expr_at(s->init.expr));
+        s->init.sym = sym_new(SYM_LOCAL, s->init.name, s->pos);
+        s->init.sym->init = s;
+        declare_local(s->init.sym);
+        break;
+    case STMT_ASSIGN:
+        resolve_expr(expr_at(s->assign.left));
+        resolve_expr(expr_at(s->assign.right));
+        break;
+    case STMT_EXPR:
+        resolve_expr(expr_at(s->expr));
+        break;
+    default:
+        break;
+    }
+}
+
+static void resolve_func(decl* d)
+{
+    func_decl* func = &d->func_decl;
+    for(size_t i = 0; i < func->num_params; i++)
+    {
+        resolve_typespec(func->param_list[i].type, d->pos);
+    }
+    for(size_t i = 0; i < func->num_return; i++)
+    {
+        resolve_typespec(func->return_type[i], d->pos);
+    }
+    // Parameters and the body's top level share a scope, so a local can't
+    // redeclare a parameter.
+    push_scope();
+    for(size_t i = 0; i < func->num_params; i++)
+    {
+        sym* s = sym_new(SYM_PARAM, func->param_list[i].name, d->pos);
+        s->param = &func->param_list[i];
+        declare_local(s);
+    }
+    resolve_stmts(*func_decl_body(d));
+    pop_scope();
+}
+
+static void resolve_decl(decl* d)
+{
+    switch(d->type)
+    {
+    case DECL_ENUM:
+    case DECL_ERR:
+        for(size_t i = 0; i < d->enum_decl.num_items; i++)
+        {
+            resolve_expr(d->enum_decl.items[i].init);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        for(size_t i = 0; i < d->aggregate_decl.num_items; i++)
+        {
+            aggregate_item* item = &d->aggregate_decl.items[i];
+            resolve_typespec(item->type, d->pos);
+            resolve_expr(item->init);
+        }
+        break;
+    case DECL_VAR:
+        resolve_typespec(d->var_decl.type, d->pos);
+        resolve_expr(d->var_decl.expr);
+        break;
+    case DECL_CONST:
+        resolve_typespec(d->const_decl.type, d->pos);
+        resolve_expr(d->const_decl.expr);
+        break;
+    case DECL_FUNC:
+        resolve_func(d);
+        break;
+    default:
+        break;
+    }
+}
+
+static sym_kind decl_sym_kind(decl* d)
+{
+    switch(d->type)
+    {
+    case DECL_ENUM:
+    case DECL_ERR:
+    case DECL_STRUCT:
+    case DECL_UNION:
+        return SYM_TYPE;
+    case DECL_VAR:
+        return SYM_VAR;
+    case DECL_CONST:
+        return SYM_CONST;
+    case DECL_FUNC:
+        return SYM_FUNC;
+    default:
+        return SYM_NONE;
+    }
+}
+
+// Frees the symbols of the last package resolved.
+void resolve_reset()
+{
+    arena_reset(&res.arena);
+    res.globals = (scope_table){0};
+    res.locals = (scope_table){0};
+    buf_clear(res.shadowed);
+    buf_clear(res.scopes);
+}
+
+// Resolves every name in decls. Errors are reported through error_at.
+void resolve_package(decl** decls, size_t num_decls)
+{
+    resolve_reset();
+    res.walker.pre = resolve_node;
+    for(size_t i = 0; i < NUM_NAMES(builtin_type_names); i++)
+    {
+        declare_global(sym_new(SYM_TYPE, str_intern(builtin_type_names[i]), 0));
+    }
+    for(size_t i = 0; i < num_decls; i++)
+    {
+        sym_kind kind = decl_sym_kind(decls[i]);
+        if(kind != SYM_NONE)
+        {
+            decls[i]->sym = sym_new(kind, decls[i]->name, decls[i]->pos);
+            decls[i]->sym->decl = decls[i];
+            declare_global(decls[i]->sym);
+        }
+    }
+    for(size_t i = 0; i < num_decls; i++)
+    {
+        resolve_decl(decls[i]);
+    }
+}
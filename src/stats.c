@@ -0,0 +1,282 @@
+// Compile statistics for --stats. Each worker counts into its own
+// thread_stats and folds them into total_stats when it finishes, so nothing
+// is shared while files are being processed.
+
+#undef MEM_TAG
+#define MEM_TAG MEM_OTHER
+
+typedef enum
+{
+    PHASE_READ,
+    PHASE_CACHE,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_RESOLVE,
+    PHASE_CHECK,
+    NUM_PHASES,
+} stats_phase;
+
+const char* phase_names[NUM_PHASES] =
+{
+    [PHASE_READ] = "read",
+    [PHASE_CACHE] = "cache",
+    [PHASE_LEX] = "lex",
+    [PHASE_PARSE] = "parse",
+    [PHASE_RESOLVE] = "resolve",
+    [PHASE_CHECK] = "check",
+};
+
+#define NUM_NAMES(names) (sizeof(names)/sizeof(*(names)))
+
+typedef struct
+{
+    double wall[NUM_PHASES];
+    double cpu[NUM_PHASES];
+    u64 files;
+    u64 bytes;
+    u64 tokens[NUM_TOKEN_KINDS];
+    u64 typespecs[NUM_NAMES(typespec_type_names)];
+    u64 decls[NUM_NAMES(decl_type_names)];
+    u64 exprs[NUM_NAMES(expr_type_names)];
+    u64 stmts[NUM_NAMES(stmt_type_names)];
+    u64 intern_lookups;
+    u64 intern_cache_hits;
+    u64 arena_bytes;
+    u64 arena_blocks;
+} compile_stats;
+
+typedef enum
+{
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON,
+} stats_format;
+
+stats_format stats_mode;
+_Thread_local compile_stats thread_stats;
+compile_stats total_stats;
+pthread_mutex_t total_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct
+{
+    double wall;
+    double cpu;
+} stats_timer;
+
+static double clock_seconds(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+stats_timer stats_start()
+{
+    if(!stats_mode)
+    {
+        return (stats_timer){0};
+    }
+    return (stats_timer){clock_seconds(CLOCK_MONOTONIC), clock_seconds(CLOCK_THREAD_CPUTIME_ID)};
+}
+
+void stats_stop(stats_phase phase, stats_timer start)
+{
+    if(stats_mode)
+    {
+        thread_stats.wall[phase] += clock_seconds(CLOCK_MONOTONIC) - start.wall;
+        thread_stats.cpu[phase] += clock_seconds(CLOCK_THREAD_CPUTIME_ID) - start.cpu;
+    }
+}
+
+void stats_count_tokens(token_buffer* tokens)
+{
+    for(size_t i = 0; i < buf_len(tokens->kinds); i++)
+    {
+        thread_stats.tokens[tokens->kinds[i]]++;
+    }
+}
+
+static walk_action stats_count_node(void* ctx, ast_node node)
+{
+    compile_stats* stats = ctx;
+    switch(node.kind)
+    {
+    case AST_TYPESPEC:
+        stats->typespecs[node.type->type]++;
+        break;
+    case AST_DECL:
+        stats->decls[node.decl->type]++;
+        break;
+    case AST_EXPR:
+        stats->exprs[node.expr->type]++;
+        break;
+    case AST_STMT:
+        stats->stmts[node.stmt->type]++;
+        break;
+    default:
+        break;
+    }
+    return WALK_CONTINUE;
+}
+
+static _Thread_local ast_walker stats_walker;
+
+// Typespecs are counted once per reference, shared or not.
+void stats_count_decls(decl** decls, size_t num_decls)
+{
+    stats_walker.pre = stats_count_node;
+    stats_walker.ctx = &thread_stats;
+    for(size_t i = 0; i < num_decls; i++)
+    {
+        ast_walk(&stats_walker, AST_DECL, decls[i]);
+    }
+}
+
+static void stats_add(u64* total, const u64* counts, size_t num)
+{
+    for(size_t i = 0; i < num; i++)
+    {
+        total[i] += counts[i];
+    }
+}
+
+// Folds the calling thread's counts into total_stats. Called by each worker
+// once it runs out of files, while its thread-local arena is still alive.
+void stats_flush_thread()
+{
+    if(!stats_mode)
+    {
+        return;
+    }
+    compile_stats* s = &thread_stats;
+    s->intern_lookups = intern_lookups;
+    s->intern_cache_hits = intern_cache_hits;
+    s->arena_bytes = arena_size(&ast_arena);
+    s->arena_blocks = buf_len(ast_arena.blocks);
+    pthread_mutex_lock(&total_stats_lock);
+    compile_stats* t = &total_stats;
+    for(int i = 0; i < NUM_PHASES; i++)
+    {
+        t->wall[i] += s->wall[i];
+        t->cpu[i] += s->cpu[i];
+    }
+    t->files += s->files;
+    t->bytes += s->bytes;
+    stats_add(t->tokens, s->tokens, NUM_NAMES(s->tokens));
+    stats_add(t->typespecs, s->typespecs, NUM_NAMES(s->typespecs));
+    stats_add(t->decls, s->decls, NUM_NAMES(s->decls));
+    stats_add(t->exprs, s->exprs, NUM_NAMES(s->exprs));
+    stats_add(t->stmts, s->stmts, NUM_NAMES(s->stmts));
+    t->intern_lookups += s->intern_lookups;
+    t->intern_cache_hits += s->intern_cache_hits;
+    t->arena_bytes += s->arena_bytes;
+    t->arena_blocks += s->arena_blocks;
+    pthread_mutex_unlock(&total_stats_lock);
+    ast_walker_free(&stats_walker);
+    *s = (compile_stats){0};
+}
+
+// Folds in a phase the calling thread ran on its own after the workers were
+// flushed.
+void stats_flush_phase(stats_phase phase)
+{
+    total_stats.wall[phase] += thread_stats.wall[phase];
+    total_stats.cpu[phase] += thread_stats.cpu[phase];
+    thread_stats.wall[phase] = 0;
+    thread_stats.cpu[phase] = 0;
+}
+
+static double percent(u64 part, u64 whole)
+{
+    return whole ? 100.0*part/whole : 0.0;
+}
+
+static void print_counts_text(const char* title, const u64* counts, const char** names, size_t num)
+{
+    u64 total = 0;
+    for(size_t i = 0; i < num; i++)
+    {
+        total += counts[i];
+    }
+    printf("%s: %llu\n", title, (unsigned long long)total);
+    for(size_t i = 0; i < num; i++)
+    {
+        if(counts[i])
+        {
+            printf("    %-10s %12llu\n", names[i], (unsigned long long)counts[i]);
+        }
+    }
+}
+
+static void print_counts_json(const char* title, const u64* counts, const char** names, size_t num)
+{
+    printf("  \"%s\": {", title);
+    const char* sep = "";
+    for(size_t i = 0; i < num; i++)
+    {
+        if(counts[i])
+        {
+            printf("%s\"%s\": %llu", sep, names[i], (unsigned long long)counts[i]);
+            sep = ", ";
+        }
+    }
+    printf("},\n");
+}
+
+// Phase times are summed over worker threads; total is the run's wall clock
+// time and the whole process's CPU time.
+void stats_print(double wall_time)
+{
+    compile_stats* t = &total_stats;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu_time = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec*1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec*1e-6;
+    // Linux reports ru_maxrss in kilobytes.
+    u64 peak_rss = (u64)usage.ru_maxrss*1024;
+    u64 intern_hits = t->intern_lookups - CLAMP_MAX(interns.len, t->intern_lookups);
+    u64 num_typespecs = typespecs.len;
+    u64 typespec_bytes = arena_size(&typespecs.arena);
+    const char* token_names[NUM_TOKEN_KINDS];
+    for(int i = 0; i < NUM_TOKEN_KINDS; i++)
+    {
+        token_names[i] = token_type_name(i);
+    }
+    if(stats_mode == STATS_JSON)
+    {
+        printf("{\n  \"phases\": {");
+        for(int i = 0; i < NUM_PHASES; i++)
+        {
+            printf("%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", i ? ", " : "", phase_names[i], t->wall[i], t->cpu[i]);
+        }
+        printf(", \"total\": {\"wall\": %.6f, \"cpu\": %.6f}},\n", wall_time, cpu_time);
+        printf("  \"files\": %llu,\n  \"bytes\": %llu,\n", (unsigned long long)t->files, (unsigned long long)t->bytes);
+        print_counts_json("tokens", t->tokens, token_names, NUM_TOKEN_KINDS);
+        print_counts_json("typespecs", t->typespecs, typespec_type_names, NUM_NAMES(typespec_type_names));
+        print_counts_json("decls", t->decls, decl_type_names, NUM_NAMES(decl_type_names));
+        print_counts_json("exprs", t->exprs, expr_type_names, NUM_NAMES(expr_type_names));
+        print_counts_json("stmts", t->stmts, stmt_type_names, NUM_NAMES(stmt_type_names));
+        printf("  \"interner\": {\"strings\": %zu, \"bytes\": %zu, \"lookups\": %llu, \"cache_hits\": %llu, \"hits\": %llu},\n",
+            interns.len, arena_size(&interns.arena), (unsigned long long)t->intern_lookups, (unsigned long long)t->intern_cache_hits, (unsigned long long)intern_hits);
+        printf("  \"typespec_table\": {\"entries\": %llu, \"bytes\": %llu},\n", (unsigned long long)num_typespecs, (unsigned long long)typespec_bytes);
+        printf("  \"ast_arena\": {\"bytes\": %llu, \"blocks\": %llu},\n", (unsigned long long)t->arena_bytes, (unsigned long long)t->arena_blocks);
+        printf("  \"peak_rss\": %llu\n}\n", (unsigned long long)peak_rss);
+        return;
+    }
+    printf("phase          wall        cpu\n");
+    for(int i = 0; i < NUM_PHASES; i++)
+    {
+        printf("%-8s %9.3fs %9.3fs\n", phase_names[i], t->wall[i], t->cpu[i]);
+    }
+    printf("%-8s %9.3fs %9.3fs\n", "total", wall_time, cpu_time);
+    printf("files: %llu, %llu bytes\n", (unsigned long long)t->files, (unsigned long long)t->bytes);
+    print_counts_text("tokens", t->tokens, token_names, NUM_TOKEN_KINDS);
+    print_counts_text("typespecs", t->typespecs, typespec_type_names, NUM_NAMES(typespec_type_names));
+    print_counts_text("decls", t->decls, decl_type_names, NUM_NAMES(decl_type_names));
+    print_counts_text("exprs", t->exprs, expr_type_names, NUM_NAMES(expr_type_names));
+    print_counts_text("stmts", t->stmts, stmt_type_names, NUM_NAMES(stmt_type_names));
+    printf("interner: %zu strings, %zu bytes, %llu lookups, %.1f%% hits, %.1f%% from thread caches\n",
+        interns.len, arena_size(&interns.arena), (unsigned long long)t->intern_lookups, percent(intern_hits, t->intern_lookups), percent(t->intern_cache_hits, t->intern_lookups));
+    printf("typespec table: %llu entries, %llu bytes\n", (unsigned long long)num_typespecs, (unsigned long long)typespec_bytes);
+    printf("ast arena: %llu bytes in %llu blocks\n", (unsigned long long)t->arena_bytes, (unsigned long long)t->arena_blocks);
+    printf("peak rss: %llu bytes\n", (unsigned long long)peak_rss);
+}
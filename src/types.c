@@ -0,0 +1,1632 @@
+// Type checking. Runs after name resolution and gives every symbol a Type.
+// Types are interned: builtins are singletons, structs, unions and enums get
+// one Type per declaration, and pointer, array and function types are
+// hash-consed like typespecs, so two types are the same exactly when they're
+// the same pointer. Sizes and alignments are worked out when a type is
+// created, or for aggregates when their fields are first needed.
+
+#undef MEM_TAG
+#define MEM_TAG MEM_TYPES
+
+typedef enum
+{
+    TYPE_NONE,
+    TYPE_VOID,
+    TYPE_BOOL,
+    TYPE_I8,
+    TYPE_I16,
+    TYPE_I32,
+    TYPE_I64,
+    TYPE_U8,
+    TYPE_U16,
+    TYPE_U32,
+    TYPE_U64,
+    TYPE_F32,
+    TYPE_F64,
+    TYPE_PTR,
+    TYPE_ARRAY,
+    TYPE_FUNC,
+    TYPE_STRUCT,
+    TYPE_UNION,
+    TYPE_ENUM,
+    NUM_TYPE_KINDS,
+} type_kind;
+
+const char* type_kind_names[NUM_TYPE_KINDS] =
+{
+    [TYPE_NONE] = "<error>",
+    [TYPE_VOID] = "void",
+    [TYPE_BOOL] = "bool",
+    [TYPE_I8] = "i8",
+    [TYPE_I16] = "i16",
+    [TYPE_I32] = "i32",
+    [TYPE_I64] = "i64",
+    [TYPE_U8] = "u8",
+    [TYPE_U16] = "u16",
+    [TYPE_U32] = "u32",
+    [TYPE_U64] = "u64",
+    [TYPE_F32] = "f32",
+    [TYPE_F64] = "f64",
+    [TYPE_PTR] = "ptr",
+    [TYPE_ARRAY] = "array",
+    [TYPE_FUNC] = "fn",
+    [TYPE_STRUCT] = "struct",
+    [TYPE_UNION] = "union",
+    [TYPE_ENUM] = "enum",
+};
+
+typedef enum
+{
+    TYPE_INCOMPLETE,
+    TYPE_COMPLETING,
+    TYPE_COMPLETE,
+} type_state;
+
+typedef struct
+{
+    const char* name;
+    Type* type;
+    u32 offset;
+} type_field;
+
+// A len of zero is an array whose size wasn't given.
+typedef struct
+{
+    Type* elem;
+    u32 len;
+} array_type;
+
+typedef struct
+{
+    Type** params;
+    Type** rets;
+    u32 num_params;
+    u32 num_rets;
+} func_type;
+
+// Enum items are kept as fields of the enum's own type.
+typedef struct
+{
+    decl* decl;
+    type_field* fields;
+    u32 num_fields;
+} aggregate_type;
+
+struct Type
+{
+    u8 kind;
+    u8 state;
+    u32 size;
+    u32 align;
+    union
+    {
+        Type* elem;
+        array_type array;
+        func_type func;
+        aggregate_type aggregate;
+    };
+};
+
+#define BUILTIN_TYPE(kind, size) [kind] = {kind, TYPE_COMPLETE, size, size}
+
+Type builtin_types[TYPE_F64 + 1] =
+{
+    [TYPE_NONE] = {TYPE_NONE, TYPE_COMPLETE, 0, 1},
+    [TYPE_VOID] = {TYPE_VOID, TYPE_COMPLETE, 0, 1},
+    BUILTIN_TYPE(TYPE_BOOL, 1),
+    BUILTIN_TYPE(TYPE_I8, 1),
+    BUILTIN_TYPE(TYPE_I16, 2),
+    BUILTIN_TYPE(TYPE_I32, 4),
+    BUILTIN_TYPE(TYPE_I64, 8),
+    BUILTIN_TYPE(TYPE_U8, 1),
+    BUILTIN_TYPE(TYPE_U16, 2),
+    BUILTIN_TYPE(TYPE_U32, 4),
+    BUILTIN_TYPE(TYPE_U64, 8),
+    BUILTIN_TYPE(TYPE_F32, 4),
+    BUILTIN_TYPE(TYPE_F64, 8),
+};
+
+#define PTR_SIZE 8
+
+Type* type_none = &builtin_types[TYPE_NONE];
+Type* type_void = &builtin_types[TYPE_VOID];
+Type* type_bool = &builtin_types[TYPE_BOOL];
+Type* type_i32 = &builtin_types[TYPE_I32];
+Type* type_i64 = &builtin_types[TYPE_I64];
+Type* type_u8 = &builtin_types[TYPE_U8];
+Type* type_u64 = &builtin_types[TYPE_U64];
+Type* type_f64 = &builtin_types[TYPE_F64];
+
+bool is_integer_type(Type* t)
+{
+    return TYPE_I8 <= t->kind && t->kind <= TYPE_U64;
+}
+
+bool is_arithmetic_type(Type* t)
+{
+    return TYPE_I8 <= t->kind && t->kind <= TYPE_F64;
+}
+
+bool is_float_type(Type* t)
+{
+    return t->kind == TYPE_F32 || t->kind == TYPE_F64;
+}
+
+bool is_scalar_type(Type* t)
+{
+    return (TYPE_BOOL <= t->kind && t->kind <= TYPE_PTR) || t->kind == TYPE_ENUM;
+}
+
+// A key two pointers wide mapped to a value. The checker keeps one map from
+// typespecs to the types they name and one from aggregate and field name to
+// the field.
+typedef struct
+{
+    const void* key;
+    const void* key2;
+    void* val;
+} type_map_entry;
+
+typedef struct
+{
+    type_map_entry* entries;
+    size_t len;
+    size_t cap;
+} type_map;
+
+// Pointer, array and function types, hash-consed by structure.
+typedef struct
+{
+    Type** entries;
+    size_t len;
+    size_t cap;
+} type_table;
+
+typedef struct
+{
+    Type* type;
+    // An int or float literal, or arithmetic on them. Converts to any
+    // arithmetic type that can hold its kind of number.
+    bool is_literal;
+    bool is_lvalue;
+    // A type name used as an expression. Only valid in front of a '.'.
+    bool is_type;
+} operand;
+
+typedef enum
+{
+    EXPECT_ROOT,
+    EXPECT_COMPOUND,
+    EXPECT_CALL,
+} expect_kind;
+
+// Where the expected types of a compound literal's or call's arguments come
+// from. Untyped compound literals like {1, 2} take their type from this.
+typedef struct
+{
+    u8 kind;
+    u32 num_args;
+    u32 next;
+    // The root frame has the expression being checked instead of a list.
+    union
+    {
+        expr_ref* args;
+        expr* root;
+    };
+    // Length of the operand stack when the frame was pushed, so a call's
+    // callee is found at base once it's been checked.
+    size_t base;
+    Type* type;
+} expect_frame;
+
+// Like resolution, checking runs on one thread after parsing. Types live in
+// the checker's arena until the next package is checked.
+typedef struct
+{
+    arena arena;
+    type_table types;
+    type_map typespec_types;
+    type_map fields;
+    // Results of the subexpressions being checked, innermost last.
+    operand* operands;
+    expect_frame* frames;
+    // Checking an expression can need the type of a global declared with an
+    // initializer, which means checking another expression in the middle of
+    // walking the first, so each level of nesting walks with its own walker.
+    ast_walker** walkers;
+    size_t depth;
+    decl* func;
+    // Buffers type_str prints into, reused round robin.
+    char* names[4];
+    u32 next_name;
+} type_checker;
+
+static type_checker checker = {.arena.tag = MEM_TYPES};
+
+#define TYPE_MIN_CAP 256
+
+static u64 type_map_hash(const void* key, const void* key2)
+{
+    return hash_mix((uintptr_t)key ^ hash_mix((uintptr_t)key2));
+}
+
+static type_map_entry* type_map_find(type_map* map, const void* key, const void* key2)
+{
+    size_t i = type_map_hash(key, key2) & (map->cap - 1);
+    while(map->entries[i].key && (map->entries[i].key != key || map->entries[i].key2 != key2))
+    {
+        i = (i + 1) & (map->cap - 1);
+    }
+    return &map->entries[i];
+}
+
+static void* type_map_get(type_map* map, const void* key, const void* key2)
+{
+    return map->cap ? type_map_find(map, key, key2)->val : NULL;
+}
+
+static void type_map_put(type_map* map, const void* key, const void* key2, void* val)
+{
+    if(2*map->len >= map->cap)
+    {
+        type_map old = *map;
+        map->cap = CLAMP_MIN(2*old.cap, TYPE_MIN_CAP);
+        map->entries = arena_alloc(&checker.arena, map->cap*sizeof(type_map_entry));
+        memset(map->entries, 0, map->cap*sizeof(type_map_entry));
+        for(size_t i = 0; i < old.cap; i++)
+        {
+            if(old.entries[i].key)
+            {
+                *type_map_find(map, old.entries[i].key, old.entries[i].key2) = old.entries[i];
+            }
+        }
+    }
+    type_map_entry* entry = type_map_find(map, key, key2);
+    if(!entry->key)
+    {
+        map->len++;
+    }
+    *entry = (type_map_entry){key, key2, val};
+}
+
+static u64 type_hash(const Type* t)
+{
+    u64 h = hash_mix(t->kind);
+    switch(t->kind)
+    {
+    case TYPE_PTR:
+        h = hash_mix(h ^ (uintptr_t)t->elem);
+        break;
+    case TYPE_ARRAY:
+        h = hash_mix(h ^ (uintptr_t)t->array.elem ^ (u64)t->array.len << 32);
+        break;
+    case TYPE_FUNC:
+        h = hash_mix(h ^ t->func.num_params ^ (u64)t->func.num_rets << 32);
+        for(size_t i = 0; i < t->func.num_params; i++)
+        {
+            h = hash_mix(h ^ (uintptr_t)t->func.params[i]);
+        }
+        for(size_t i = 0; i < t->func.num_rets; i++)
+        {
+            h = hash_mix(h ^ (uintptr_t)t->func.rets[i]);
+        }
+        break;
+    default:
+        assert(0);
+    }
+    return h;
+}
+
+static bool type_equal(const Type* a, const Type* b)
+{
+    if(a->kind != b->kind)
+    {
+        return false;
+    }
+    switch(a->kind)
+    {
+    case TYPE_PTR:
+        return a->elem == b->elem;
+    case TYPE_ARRAY:
+        return a->array.elem == b->array.elem && a->array.len == b->array.len;
+    case TYPE_FUNC:
+        return a->func.num_params == b->func.num_params && a->func.num_rets == b->func.num_rets &&
+               (!a->func.num_params || memcmp(a->func.params, b->func.params, a->func.num_params*sizeof(Type*)) == 0) &&
+               (!a->func.num_rets || memcmp(a->func.rets, b->func.rets, a->func.num_rets*sizeof(Type*)) == 0);
+    default:
+        return false;
+    }
+}
+
+static void type_table_grow()
+{
+    type_table old = checker.types;
+    checker.types.cap = CLAMP_MIN(2*old.cap, TYPE_MIN_CAP);
+    checker.types.entries = arena_alloc(&checker.arena, checker.types.cap*sizeof(Type*));
+    memset(checker.types.entries, 0, checker.types.cap*sizeof(Type*));
+    for(size_t i = 0; i < old.cap; i++)
+    {
+        if(old.entries[i])
+        {
+            size_t j = type_hash(old.entries[i]) & (checker.types.cap - 1);
+            while(checker.types.entries[j])
+            {
+                j = (j + 1) & (checker.types.cap - 1);
+            }
+            checker.types.entries[j] = old.entries[i];
+        }
+    }
+}
+
+// Returns the interned type equal to key, copying key in if it's new.
+static Type* type_canonical(const Type* key)
+{
+    if(2*checker.types.len >= checker.types.cap)
+    {
+        type_table_grow();
+    }
+    size_t i = type_hash(key) & (checker.types.cap - 1);
+    for(;;)
+    {
+        Type* t = checker.types.entries[i];
+        if(!t)
+        {
+            break;
+        }
+        if(type_equal(t, key))
+        {
+            return t;
+        }
+        i = (i + 1) & (checker.types.cap - 1);
+    }
+    Type* t = arena_alloc(&checker.arena, sizeof(Type));
+    *t = *key;
+    if(t->kind == TYPE_FUNC)
+    {
+        size_t params_size = t->func.num_params*sizeof(Type*);
+        size_t rets_size = t->func.num_rets*sizeof(Type*);
+        t->func.params = params_size ? memcpy(arena_alloc(&checker.arena, params_size), key->func.params, params_size) : NULL;
+        t->func.rets = rets_size ? memcpy(arena_alloc(&checker.arena, rets_size), key->func.rets, rets_size) : NULL;
+    }
+    checker.types.entries[i] = t;
+    checker.types.len++;
+    return t;
+}
+
+Type* type_ptr(Type* elem)
+{
+    Type key = {TYPE_PTR, TYPE_COMPLETE, PTR_SIZE, PTR_SIZE};
+    key.elem = elem;
+    return type_canonical(&key);
+}
+
+// elem must be complete, since the array's size comes from it, and the size
+// must fit in a u32.
+Type* type_array(Type* elem, u32 len)
+{
+    assert((u64)elem->size*len <= UINT32_MAX);
+    Type key = {TYPE_ARRAY, TYPE_COMPLETE, elem->size*len, elem->align};
+    key.array = (array_type){elem, len};
+    return type_canonical(&key);
+}
+
+Type* type_func(Type** params, size_t num_params, Type** rets, size_t num_rets)
+{
+    Type key = {TYPE_FUNC, TYPE_COMPLETE, PTR_SIZE, PTR_SIZE};
+    key.func = (func_type){params, rets, (u32)num_params, (u32)num_rets};
+    return type_canonical(&key);
+}
+
+// Structs, unions and enums are nominal, so each declaration gets its own
+// type. Fields are filled in by type_complete.
+Type* type_aggregate(type_kind kind, decl* d)
+{
+    Type* t = arena_alloc(&checker.arena, sizeof(Type));
+    *t = (Type){kind, TYPE_INCOMPLETE, 0, 1};
+    t->aggregate = (aggregate_type){d};
+    return t;
+}
+
+static void type_print(char** buf, Type* t)
+{
+    switch(t->kind)
+    {
+    case TYPE_PTR:
+        type_print(buf, t->elem);
+        buf_printf(*buf, "^");
+        break;
+    case TYPE_ARRAY:
+        type_print(buf, t->array.elem);
+        if(t->array.len)
+        {
+            buf_printf(*buf, "[%u]", t->array.len);
+        }
+        else
+        {
+            buf_printf(*buf, "[]");
+        }
+        break;
+    case TYPE_FUNC:
+        buf_printf(*buf, "fn(");
+        for(size_t i = 0; i < t->func.num_params; i++)
+        {
+            buf_printf(*buf, i ? ", " : "");
+            type_print(buf, t->func.params[i]);
+        }
+        buf_printf(*buf, ")");
+        for(size_t i = 0; i < t->func.num_rets; i++)
+        {
+            buf_printf(*buf, i ? ", " : ": ");
+            type_print(buf, t->func.rets[i]);
+        }
+        break;
+    case TYPE_STRUCT:
+    case TYPE_UNION:
+    case TYPE_ENUM:
+        buf_printf(*buf, "%s", t->aggregate.decl->name);
+        break;
+    default:
+        buf_printf(*buf, "%s", type_kind_names[t->kind]);
+        break;
+    }
+}
+
+// Spelling of t for error messages. Stays valid until a few more types
+// have been printed.
+const char* type_str(Type* t)
+{
+    char** buf = &checker.names[checker.next_name++ % NUM_NAMES(checker.names)];
+    buf_clear(*buf);
+    type_print(buf, t);
+    return *buf;
+}
+
+typedef enum
+{
+    SYM_UNCHECKED,
+    SYM_CHECKING,
+    SYM_CHECKED,
+    // A checked constant whose value eval_const is working out.
+    SYM_EVALUATING,
+} sym_state;
+
+static void check_decl(decl* d);
+Type* sym_type(sym* s);
+static operand check_expr(expr* e, Type* expected);
+
+// Value of an integer constant expression, for array sizes.
+static bool eval_const(expr* e, i64* val)
+{
+    switch(e->type)
+    {
+    case EXPR_INT:
+        *val = (i64)e->int_val;
+        return e->int_val <= INT64_MAX;
+    case EXPR_NAME:
+    {
+        sym* s = e->sym;
+        // A constant reached again while working out its own value is part of
+        // a cycle, which checking its declaration has already reported.
+        if(!s || s->kind != SYM_CONST || !s->decl->const_decl.expr || s->state == SYM_EVALUATING || !is_integer_type(sym_type(s)))
+        {
+            return false;
+        }
+        s->state = SYM_EVALUATING;
+        bool ok = eval_const(s->decl->const_decl.expr, val);
+        s->state = SYM_CHECKED;
+        return ok;
+    }
+    case EXPR_UNARY:
+        if(!eval_const(expr_at(e->unary.expr), val))
+        {
+            return false;
+        }
+        if(e->op == TOKEN_SUB)
+        {
+            if(*val == INT64_MIN)
+            {
+                return false;
+            }
+            *val = -*val;
+        }
+        else if(e->op == TOKEN_NEG)
+        {
+            *val = ~*val;
+        }
+        return e->op == TOKEN_ADD || e->op == TOKEN_SUB || e->op == TOKEN_NEG;
+    case EXPR_BINARY:
+    {
+        i64 left, right;
+        if(!eval_const(expr_at(e->binary.left), &left) || !eval_const(expr_at(e->binary.right), &right))
+        {
+            return false;
+        }
+        switch(e->op)
+        {
+        // Anything that overflows i64 is no use as a size, so it fails
+        // rather than wrapping.
+        case TOKEN_ADD: return !__builtin_add_overflow(left, right, val);
+        case TOKEN_SUB: return !__builtin_sub_overflow(left, right, val);
+        case TOKEN_MUL: return !__builtin_mul_overflow(left, right, val);
+        case TOKEN_DIV:
+        case TOKEN_MOD:
+            if(right == 0 || (left == INT64_MIN && right == -1))
+            {
+                return false;
+            }
+            *val = e->op == TOKEN_DIV ? left/right : left%right;
+            return true;
+        case TOKEN_AND: *val = left & right; return true;
+        case TOKEN_LSHIFT:
+            if(right < 0 || right >= 63 || left < 0 || left > INT64_MAX >> right)
+            {
+                return false;
+            }
+            *val = left << right;
+            return true;
+        case TOKEN_RSHIFT:
+            if(right < 0 || right >= 63)
+            {
+                return false;
+            }
+            *val = left >> right;
+            return true;
+        default: return false;
+        }
+    }
+    default:
+        return false;
+    }
+}
+
+static void type_complete(Type* t);
+
+// Type named by a typespec. Typespecs are hash-consed too, so each distinct
+// one is only converted once. A typespec with errors is shared between every
+// place that spells it, so those aren't cached and each use reports at pos.
+Type* type_from_typespec(typespec* ts, u32 pos)
+{
+    Type* cached = type_map_get(&checker.typespec_types, ts, NULL);
+    if(cached)
+    {
+        return cached;
+    }
+    int errors = error_count;
+    Type* t = type_none;
+    switch(ts->type)
+    {
+    case TYPESPEC_NAME:
+        t = ts->sym ? sym_type(ts->sym) : type_none;
+        break;
+    case TYPESPEC_PTR:
+        t = type_ptr(type_from_typespec(ts->ptr.elem, pos));
+        break;
+    case TYPESPEC_ARRAY:
+    {
+        Type* elem = type_from_typespec(ts->array.elem, pos);
+        type_complete(elem);
+        i64 len = 0;
+        if(ts->array.size)
+        {
+            check_expr(ts->array.size, NULL);
+            if(!eval_const(ts->array.size, &len) || len <= 0 || len > UINT32_MAX)
+            {
+                error_at(pos, "Array size must be a positive integer constant");
+                len = 1;
+            }
+        }
+        if((u64)elem->size*len > UINT32_MAX)
+        {
+            error_at(pos, "Array too large");
+            len = 1;
+        }
+        t = type_array(elem, (u32)len);
+        break;
+    }
+    case TYPESPEC_FUNC:
+    {
+        small_buf(Type*, 8) types = {0};
+        for(size_t i = 0; i < ts->func.num_args; i++)
+        {
+            small_buf_push(types, type_from_typespec(ts->func.args[i], pos));
+        }
+        for(size_t i = 0; i < ts->func.num_rets; i++)
+        {
+            small_buf_push(types, type_from_typespec(ts->func.rets[i], pos));
+        }
+        Type** items = small_buf_items(types);
+        t = type_func(items, ts->func.num_args, items + ts->func.num_args, ts->func.num_rets);
+        small_buf_free(types);
+        break;
+    }
+    default:
+        break;
+    }
+    if(error_count == errors)
+    {
+        type_map_put(&checker.typespec_types, ts, NULL, t);
+    }
+    return t;
+}
+
+// Lays out a struct or union, or collects an enum's items. Only a type that
+// contains itself by value, not through a pointer, runs into itself here.
+static void type_complete(Type* t)
+{
+    if(t->state == TYPE_COMPLETE)
+    {
+        return;
+    }
+    decl* d = t->aggregate.decl;
+    if(t->state == TYPE_COMPLETING)
+    {
+        error_at(d->pos, "Type %s contains itself", d->name);
+        return;
+    }
+    t->state = TYPE_COMPLETING;
+    if(t->kind == TYPE_ENUM)
+    {
+        t->aggregate.num_fields = d->enum_decl.num_items;
+        t->aggregate.fields = arena_alloc(&checker.arena, t->aggregate.num_fields*sizeof(type_field));
+        for(size_t i = 0; i < d->enum_decl.num_items; i++)
+        {
+            t->aggregate.fields[i] = (type_field){d->enum_decl.items[i].name, t, (u32)i};
+        }
+        t->size = t->align = 4;
+    }
+    else
+    {
+        t->aggregate.num_fields = d->aggregate_decl.num_items;
+        t->aggregate.fields = arena_alloc(&checker.arena, t->aggregate.num_fields*sizeof(type_field));
+        u32 size = 0;
+        u32 align = 1;
+        for(size_t i = 0; i < d->aggregate_decl.num_items; i++)
+        {
+            aggregate_item* item = &d->aggregate_decl.items[i];
+            Type* field = type_from_typespec(item->type, d->pos);
+            type_complete(field);
+            u32 offset = t->kind == TYPE_STRUCT ? ALIGN_UP(size, field->align) : 0;
+            t->aggregate.fields[i] = (type_field){item->name, field, offset};
+            size = MAX(size, offset + field->size);
+            align = MAX(align, field->align);
+        }
+        t->size = ALIGN_UP(size, align);
+        t->align = align;
+    }
+    for(size_t i = 0; i < t->aggregate.num_fields; i++)
+    {
+        type_field* field = &t->aggregate.fields[i];
+        if(type_map_get(&checker.fields, t, field->name))
+        {
+            error_at(d->pos, "Duplicate field %s in %s", field->name, d->name);
+            continue;
+        }
+        type_map_put(&checker.fields, t, field->name, field);
+    }
+    t->state = TYPE_COMPLETE;
+}
+
+static void type_complete_any(Type* t)
+{
+    if(t->kind == TYPE_STRUCT || t->kind == TYPE_UNION || t->kind == TYPE_ENUM)
+    {
+        type_complete(t);
+    }
+}
+
+type_field* type_field_lookup(Type* t, const char* name)
+{
+    type_complete_any(t);
+    return type_map_get(&checker.fields, t, name);
+}
+
+static operand operand_value(Type* type)
+{
+    return (operand){type};
+}
+
+static operand operand_lvalue(Type* type)
+{
+    return (operand){type, .is_lvalue = true};
+}
+
+// Makes op a value of type if it already is one or is a literal that can
+// become one. Errors stay quiet: anything involving TYPE_NONE converts.
+static bool convert_operand(operand* op, Type* type)
+{
+    if(op->type == type || op->type == type_none || type == type_none)
+    {
+        op->type = type;
+        op->is_literal = false;
+        return true;
+    }
+    if(op->is_literal && is_arithmetic_type(type) && (is_integer_type(op->type) || is_float_type(type)))
+    {
+        op->type = type;
+        op->is_literal = false;
+        return true;
+    }
+    return false;
+}
+
+static void check_assignable(u32 pos, operand* op, Type* type)
+{
+    if(!convert_operand(op, type))
+    {
+        error_at(pos, "Cannot convert %s to %s", type_str(op->type), type_str(type));
+    }
+}
+
+// Brings two arithmetic operands to a common type.
+static bool unify_arithmetic(operand* left, operand* right)
+{
+    if(!is_arithmetic_type(left->type) || !is_arithmetic_type(right->type))
+    {
+        return false;
+    }
+    if(left->type == right->type)
+    {
+        return true;
+    }
+    if(left->is_literal && (!right->is_literal || is_float_type(right->type)))
+    {
+        return convert_operand(left, right->type);
+    }
+    return right->is_literal && convert_operand(right, left->type);
+}
+
+static void check_value(u32 pos, operand* op)
+{
+    if(op->is_type)
+    {
+        error_at(pos, "%s is a type, not a value", type_str(op->type));
+        *op = operand_value(type_none);
+    }
+}
+
+static bool check_condition(u32 pos, operand op)
+{
+    check_value(pos, &op);
+    if(op.type != type_none && !is_scalar_type(op.type))
+    {
+        error_at(pos, "Condition of type %s isn't a scalar", type_str(op.type));
+        return false;
+    }
+    return true;
+}
+
+// Pops the results of e's n children off the operand stack. They stay valid
+// until the next push.
+static operand* pop_operands(size_t n)
+{
+    assert(buf_len(checker.operands) >= n);
+    buf__hdr(checker.operands)->len -= n;
+    return buf_end(checker.operands);
+}
+
+// Type an argument of the innermost compound literal or call is expected to
+// have, or NULL when e isn't one or nothing in particular is expected.
+static Type* take_expected(expr* e)
+{
+    if(!buf_len(checker.frames))
+    {
+        return NULL;
+    }
+    expect_frame* frame = &checker.frames[buf_len(checker.frames) - 1];
+    if(frame->next >= frame->num_args || (frame->kind == EXPECT_ROOT ? frame->root : expr_at(frame->args[frame->next])) != e)
+    {
+        return NULL;
+    }
+    u32 i = frame->next++;
+    Type* t = frame->type;
+    switch(frame->kind)
+    {
+    case EXPECT_ROOT:
+        return t;
+    case EXPECT_COMPOUND:
+        if(!t)
+        {
+            return NULL;
+        }
+        if(t->kind == TYPE_ARRAY)
+        {
+            return t->array.elem;
+        }
+        if(t->kind == TYPE_STRUCT || t->kind == TYPE_UNION)
+        {
+            type_complete(t);
+            return i < t->aggregate.num_fields ? t->aggregate.fields[i].type : NULL;
+        }
+        return t;
+    case EXPECT_CALL:
+    {
+        Type* callee = checker.operands[frame->base].type;
+        return callee->kind == TYPE_FUNC && i < callee->func.num_params ? callee->func.params[i] : NULL;
+    }
+    default:
+        return NULL;
+    }
+}
+
+static walk_action check_expr_pre(void* ctx, ast_node node)
+{
+    // Typespecs inside expressions are converted by the expression using them.
+    if(node.kind == AST_TYPESPEC)
+    {
+        return WALK_SKIP;
+    }
+    expr* e = node.expr;
+    Type* expected = take_expected(e);
+    if(e->type == EXPR_COMPOUND)
+    {
+        Type* type = e->compound.type ? type_from_typespec(e->compound.type, e->pos) : expected;
+        buf_push(checker.frames, (expect_frame){EXPECT_COMPOUND, e->compound.num_args, 0, {e->compound.args}, buf_len(checker.operands), type});
+    }
+    else if(e->type == EXPR_CALL)
+    {
+        buf_push(checker.frames, (expect_frame){EXPECT_CALL, e->call.num_args, 0, {e->call.args}, buf_len(checker.operands)});
+    }
+    return WALK_CONTINUE;
+}
+
+static operand check_name(expr* e)
+{
+    sym* s = e->sym;
+    if(!s)
+    {
+        return operand_value(type_none);
+    }
+    Type* type = sym_type(s);
+    switch(s->kind)
+    {
+    case SYM_TYPE:
+        return (operand){type, .is_type = true};
+    case SYM_CONST:
+        // Constants declared without a type act like the literal they hold.
+        return (operand){type, .is_literal = !s->decl->const_decl.type && is_arithmetic_type(type)};
+    case SYM_FUNC:
+        return operand_value(type);
+    default:
+        return operand_lvalue(type);
+    }
+}
+
+static operand check_call(expr* e)
+{
+    operand* args = pop_operands(e->call.num_args + 1);
+    operand callee = args[0];
+    check_value(e->pos, &callee);
+    Type* t = callee.type;
+    if(t == type_none)
+    {
+        return operand_value(type_none);
+    }
+    if(t->kind != TYPE_FUNC)
+    {
+        error_at(e->pos, "Cannot call a value of type %s", type_str(t));
+        return operand_value(type_none);
+    }
+    if(e->call.num_args != t->func.num_params)
+    {
+        error_at(e->pos, "Expected %u arguments, got %u", t->func.num_params, e->call.num_args);
+    }
+    for(size_t i = 0; i < MIN(e->call.num_args, t->func.num_params); i++)
+    {
+        operand* arg = &args[i + 1];
+        check_value(expr_at(e->call.args[i])->pos, arg);
+        check_assignable(expr_at(e->call.args[i])->pos, arg, t->func.params[i]);
+    }
+    return operand_value(t->func.num_rets == 1 ? t->func.rets[0] : type_void);
+}
+
+static operand check_compound(expr* e, Type* type)
+{
+    if(!type)
+    {
+        pop_operands(e->compound.num_args);
+        error_at(e->pos, "Compound literal has no type to take");
+        return operand_value(type_none);
+    }
+    // Completing can check array sizes, so it has to happen before the
+    // arguments are popped.
+    type_complete_any(type);
+    operand* args = pop_operands(e->compound.num_args);
+    size_t max_args = 1;
+    if(type->kind == TYPE_ARRAY)
+    {
+        max_args = type->array.len ? type->array.len : e->compound.num_args;
+    }
+    else if(type->kind == TYPE_STRUCT)
+    {
+        max_args = type->aggregate.num_fields;
+    }
+    else if(type->kind == TYPE_UNION)
+    {
+        max_args = MIN(1, type->aggregate.num_fields);
+    }
+    else if(type->kind == TYPE_ENUM || type == type_none)
+    {
+        max_args = 0;
+    }
+    if(type != type_none && e->compound.num_args > max_args)
+    {
+        error_at(e->pos, "Too many values in compound literal of type %s", type_str(type));
+    }
+    for(size_t i = 0; i < MIN(e->compound.num_args, max_args); i++)
+    {
+        Type* field = type;
+        if(type->kind == TYPE_ARRAY)
+        {
+            field = type->array.elem;
+        }
+        else if(type->kind == TYPE_STRUCT || type->kind == TYPE_UNION)
+        {
+            field = type->aggregate.fields[i].type;
+        }
+        check_value(expr_at(e->compound.args[i])->pos, &args[i]);
+        check_assignable(expr_at(e->compound.args[i])->pos, &args[i], field);
+    }
+    if(type->kind == TYPE_ARRAY && !type->array.len)
+    {
+        if((u64)type->array.elem->size*e->compound.num_args > UINT32_MAX)
+        {
+            error_at(e->pos, "Array too large");
+            return operand_value(type_none);
+        }
+        type = type_array(type->array.elem, e->compound.num_args);
+    }
+    return operand_value(type);
+}
+
+static operand check_field(expr* e, operand base)
+{
+    Type* t = base.type;
+    if(t == type_none)
+    {
+        return operand_value(type_none);
+    }
+    if(base.is_type)
+    {
+        type_field* item = t->kind == TYPE_ENUM ? type_field_lookup(t, e->field.name) : NULL;
+        if(!item)
+        {
+            error_at(e->pos, "%s has no item %s", type_str(t), e->field.name);
+            return operand_value(type_none);
+        }
+        return operand_value(t);
+    }
+    // Fields are reached through a pointer the same way.
+    bool is_lvalue = base.is_lvalue;
+    if(t->kind == TYPE_PTR)
+    {
+        t = t->elem;
+        is_lvalue = true;
+    }
+    type_field* field = t->kind == TYPE_STRUCT || t->kind == TYPE_UNION ? type_field_lookup(t, e->field.name) : NULL;
+    if(!field)
+    {
+        error_at(e->pos, "%s has no field %s", type_str(base.type), e->field.name);
+        return operand_value(type_none);
+    }
+    return (operand){field->type, .is_lvalue = is_lvalue};
+}
+
+static operand check_unary(expr* e, operand op)
+{
+    check_value(e->pos, &op);
+    Type* t = op.type;
+    if(t == type_none)
+    {
+        return op;
+    }
+    switch(e->op)
+    {
+    case TOKEN_ADD:
+    case TOKEN_SUB:
+        if(is_arithmetic_type(t))
+        {
+            return (operand){t, .is_literal = op.is_literal};
+        }
+        break;
+    case TOKEN_NEG:
+        if(is_integer_type(t))
+        {
+            return (operand){t, .is_literal = op.is_literal};
+        }
+        break;
+    case TOKEN_NOT:
+        if(is_scalar_type(t))
+        {
+            return operand_value(type_bool);
+        }
+        break;
+    case TOKEN_AND:
+        if(op.is_lvalue)
+        {
+            return operand_value(type_ptr(t));
+        }
+        error_at(e->pos, "Cannot take the address of a value that isn't stored anywhere");
+        return operand_value(type_none);
+    case TOKEN_MUL:
+        if(t->kind == TYPE_PTR)
+        {
+            return operand_lvalue(t->elem);
+        }
+        break;
+    default:
+        break;
+    }
+    error_at(e->pos, "Invalid operand %s for %s", type_str(t), token_type_name(e->op));
+    return operand_value(type_none);
+}
+
+static operand check_binary(expr* e, operand left, operand right)
+{
+    check_value(expr_at(e->binary.left)->pos, &left);
+    check_value(expr_at(e->binary.right)->pos, &right);
+    if(left.type == type_none || right.type == type_none)
+    {
+        return operand_value(type_none);
+    }
+    bool is_literal = left.is_literal && right.is_literal;
+    token_type op = e->op;
+    switch(op)
+    {
+    case TOKEN_ADD:
+    case TOKEN_SUB:
+        if(left.type->kind == TYPE_PTR && is_integer_type(right.type))
+        {
+            return operand_value(left.type);
+        }
+        if(op == TOKEN_ADD && is_integer_type(left.type) && right.type->kind == TYPE_PTR)
+        {
+            return operand_value(right.type);
+        }
+        if(op == TOKEN_SUB && left.type->kind == TYPE_PTR && left.type == right.type)
+        {
+            return operand_value(type_i64);
+        }
+        // fallthrough
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+        if(unify_arithmetic(&left, &right))
+        {
+            return (operand){left.type, .is_literal = is_literal};
+        }
+        break;
+    case TOKEN_MOD:
+    case TOKEN_AND:
+        if(is_integer_type(left.type) && is_integer_type(right.type) && unify_arithmetic(&left, &right))
+        {
+            return (operand){left.type, .is_literal = is_literal};
+        }
+        break;
+    case TOKEN_LSHIFT:
+    case TOKEN_RSHIFT:
+        if(is_integer_type(left.type) && is_integer_type(right.type))
+        {
+            return (operand){left.type, .is_literal = is_literal};
+        }
+        break;
+    case TOKEN_AND_AND:
+    case TOKEN_OR_OR:
+        if(is_scalar_type(left.type) && is_scalar_type(right.type))
+        {
+            return operand_value(type_bool);
+        }
+        break;
+    default:
+        if(TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP)
+        {
+            if(unify_arithmetic(&left, &right) || (left.type == right.type && is_scalar_type(left.type)))
+            {
+                return operand_value(type_bool);
+            }
+        }
+        break;
+    }
+    error_at(e->pos, "Invalid operands %s and %s for %s", type_str(left.type), type_str(right.type), token_type_name(op));
+    return operand_value(type_none);
+}
+
+static operand check_ternary(expr* e, operand* ops)
+{
+    check_condition(expr_at(e->ternary.cond)->pos, ops[0]);
+    operand then_op = ops[1];
+    operand else_op = ops[2];
+    check_value(expr_at(e->ternary.then_expr)->pos, &then_op);
+    check_value(expr_at(e->ternary.else_expr)->pos, &else_op);
+    bool is_literal = then_op.is_literal && else_op.is_literal;
+    if(then_op.type == else_op.type || unify_arithmetic(&then_op, &else_op))
+    {
+        return (operand){then_op.type, .is_literal = is_literal};
+    }
+    if(then_op.type == type_none || else_op.type == type_none)
+    {
+        return operand_value(type_none);
+    }
+    error_at(e->pos, "Mismatched types %s and %s in ?:", type_str(then_op.type), type_str(else_op.type));
+    return operand_value(type_none);
+}
+
+// Children are checked before their parent, so each expression finds the
+// results of its subexpressions on top of the operand stack and replaces them
+// with its own.
+static walk_action check_expr_post(void* ctx, ast_node node)
+{
+    expr* e = node.expr;
+    operand result = operand_value(type_none);
+    switch(e->type)
+    {
+    case EXPR_INT:
+    {
+        Type* t = e->int_val <= INT32_MAX ? type_i32 : e->int_val <= INT64_MAX ? type_i64 : type_u64;
+        result = (operand){t, .is_literal = true};
+        break;
+    }
+    case EXPR_FLOAT:
+        result = (operand){type_f64, .is_literal = true};
+        break;
+    case EXPR_STR:
+        result = operand_value(type_ptr(type_u8));
+        break;
+    case EXPR_NAME:
+        result = check_name(e);
+        break;
+    case EXPR_CAST:
+    {
+        operand op = *pop_operands(1);
+        check_value(e->pos, &op);
+        Type* t = type_from_typespec(e->cast.type, e->pos);
+        result = operand_value(t);
+        if(op.type != type_none && t != type_none && !(is_scalar_type(op.type) && is_scalar_type(t)))
+        {
+            error_at(e->pos, "Cannot cast %s to %s", type_str(op.type), type_str(t));
+        }
+        break;
+    }
+    case EXPR_CALL:
+        buf__hdr(checker.frames)->len--;
+        result = check_call(e);
+        break;
+    case EXPR_INDEX:
+    {
+        operand* ops = pop_operands(2);
+        operand base = ops[0];
+        operand index = ops[1];
+        check_value(e->pos, &base);
+        check_value(expr_at(e->index.index)->pos, &index);
+        if(index.type != type_none && !is_integer_type(index.type))
+        {
+            error_at(expr_at(e->index.index)->pos, "Index must be an integer, got %s", type_str(index.type));
+        }
+        if(base.type->kind == TYPE_ARRAY)
+        {
+            result = (operand){base.type->array.elem, .is_lvalue = base.is_lvalue};
+        }
+        else if(base.type->kind == TYPE_PTR)
+        {
+            result = operand_lvalue(base.type->elem);
+        }
+        else if(base.type != type_none)
+        {
+            error_at(e->pos, "Cannot index a value of type %s", type_str(base.type));
+        }
+        break;
+    }
+    case EXPR_FIELD:
+        result = check_field(e, *pop_operands(1));
+        break;
+    case EXPR_COMPOUND:
+    {
+        Type* type = checker.frames[--buf__hdr(checker.frames)->len].type;
+        result = check_compound(e, type);
+        break;
+    }
+    case EXPR_UNARY:
+        result = check_unary(e, *pop_operands(1));
+        break;
+    case EXPR_BINARY:
+    {
+        operand* ops = pop_operands(2);
+        result = check_binary(e, ops[0], ops[1]);
+        break;
+    }
+    case EXPR_TERNARY:
+        result = check_ternary(e, pop_operands(3));
+        break;
+    default:
+        break;
+    }
+    buf_push(checker.operands, result);
+    return WALK_CONTINUE;
+}
+
+// Checks e and returns its type and what can be done with it. expected is
+// only used to give untyped compound literals a type; the caller still has
+// to convert the result to whatever it needs.
+static operand check_expr(expr* e, Type* expected)
+{
+    if(checker.depth == buf_len(checker.walkers))
+    {
+        ast_walker* walker = calloc(1, sizeof(ast_walker));
+        mem_track_alloc(MEM_TYPES, sizeof(ast_walker));
+        *walker = (ast_walker){check_expr_pre, check_expr_post};
+        buf_push(checker.walkers, walker);
+    }
+    ast_walker* walker = checker.walkers[checker.depth++];
+    size_t num_frames = buf_len(checker.frames);
+    buf_push(checker.frames, (expect_frame){EXPECT_ROOT, 1, 0, {.root = e}, buf_len(checker.operands), expected});
+    ast_walk(walker, AST_EXPR, e);
+    checker.depth--;
+    buf__hdr(checker.frames)->len = num_frames;
+    return *pop_operands(1);
+}
+
+// Type of a variable or constant, from its typespec or else its initializer.
+static Type* check_var(decl* d, typespec* ts, expr* init)
+{
+    Type* type = ts ? type_from_typespec(ts, d->pos) : NULL;
+    if(type)
+    {
+        type_complete_any(type);
+    }
+    if(!init)
+    {
+        return type ? type : type_none;
+    }
+    operand op = check_expr(init, type);
+    check_value(init->pos, &op);
+    if(type)
+    {
+        check_assignable(init->pos, &op, type);
+        return type;
+    }
+    if(op.type == type_void)
+    {
+        error_at(init->pos, "Cannot infer a type from void");
+        return type_none;
+    }
+    return op.type;
+}
+
+static Type* check_func_type(decl* d)
+{
+    func_decl* func = &d->func_decl;
+    small_buf(Type*, 8) types = {0};
+    for(size_t i = 0; i < func->num_params; i++)
+    {
+        small_buf_push(types, type_from_typespec(func->param_list[i].type, d->pos));
+    }
+    for(size_t i = 0; i < func->num_return; i++)
+    {
+        small_buf_push(types, type_from_typespec(func->return_type[i], d->pos));
+    }
+    Type** items = small_buf_items(types);
+    Type* type = type_func(items, func->num_params, items + func->num_params, func->num_return);
+    small_buf_free(types);
+    return type;
+}
+
+// Type of the value or type s stands for. Globals are typed on first use, so
+// they can be used before the declaration that gives them their type.
+Type* sym_type(sym* s)
+{
+    if(s->state == SYM_CHECKED)
+    {
+        return s->type;
+    }
+    if(s->state == SYM_CHECKING)
+    {
+        error_at(s->pos, "Declaration of %s depends on itself", s->name);
+        return type_none;
+    }
+    s->state = SYM_CHECKING;
+    Type* type = s->type ? s->type : type_none;
+    switch(s->kind)
+    {
+    // Locals made by := are typed by their statement before they can be used,
+    // so the locals that get here are all declared with let.
+    case SYM_VAR:
+    case SYM_LOCAL:
+        type = check_var(s->decl, s->decl->var_decl.type, s->decl->var_decl.expr);
+        break;
+    case SYM_CONST:
+        type = check_var(s->decl, s->decl->const_decl.type, s->decl->const_decl.expr);
+        break;
+    case SYM_PARAM:
+        type = type_from_typespec(s->param->type, s->pos);
+        break;
+    case SYM_FUNC:
+        type = check_func_type(s->decl);
+        break;
+    default:
+        break;
+    }
+    s->type = type;
+    s->state = SYM_CHECKED;
+    return type;
+}
+
+static void check_stmt(stmt* s);
+
+static void check_block(s_block block)
+{
+    for(size_t i = 0; i < block.num_stmts; i++)
+    {
+        check_stmt(stmt_at(block.stmt[i]));
+    }
+}
+
+static void check_cond(expr* e)
+{
+    if(e)
+    {
+        check_condition(e->pos, check_expr(e, NULL));
+    }
+}
+
+static void check_return(stmt* s)
+{
+    func_type* func = &sym_type(checker.func->sym)->func;
+    expr* e = expr_at(s->return_stmt.expr);
+    if(!e)
+    {
+        if(func->num_rets)
+        {
+            error_at(s->pos, "Missing return value in %s", checker.func->name);
+        }
+        return;
+    }
+    Type* ret = func->num_rets == 1 ? func->rets[0] : NULL;
+    operand op = check_expr(e, ret);
+    check_value(e->pos, &op);
+    if(ret)
+    {
+        check_assignable(e->pos, &op, ret);
+    }
+    else
+    {
+        error_at(e->pos, "%s returns %u values, not 1", checker.func->name, func->num_rets);
+    }
+}
+
+static void check_assign(stmt* s)
+{
+    expr* left_expr = expr_at(s->assign.left);
+    expr* right_expr = expr_at(s->assign.right);
+    operand left = check_expr(left_expr, NULL);
+    check_value(left_expr->pos, &left);
+    if(left.type != type_none && !left.is_lvalue)
+    {
+        error_at(s->pos, "Cannot assign to a value that isn't stored anywhere");
+    }
+    token_type op = s->op;
+    if(!right_expr)
+    {
+        if(left.type != type_none && !is_arithmetic_type(left.type) && left.type->kind != TYPE_PTR)
+        {
+            error_at(s->pos, "Invalid operand %s for %s", type_str(left.type), token_type_name(op));
+        }
+        return;
+    }
+    operand right = check_expr(right_expr, left.type);
+    check_value(right_expr->pos, &right);
+    if(op == TOKEN_ASSIGN || left.type == type_none || right.type == type_none)
+    {
+        check_assignable(right_expr->pos, &right, left.type);
+        return;
+    }
+    bool valid = false;
+    switch(op)
+    {
+    case TOKEN_ADD_ASSIGN:
+    case TOKEN_SUB_ASSIGN:
+        valid = left.type->kind == TYPE_PTR && is_integer_type(right.type);
+        // fallthrough
+    case TOKEN_MUL_ASSIGN:
+    case TOKEN_DIV_ASSIGN:
+        valid = valid || (is_arithmetic_type(left.type) && convert_operand(&right, left.type));
+        break;
+    case TOKEN_MOD_ASSIGN:
+        valid = is_integer_type(left.type) && convert_operand(&right, left.type);
+        break;
+    case TOKEN_LSHIFT_ASSIGN:
+    case TOKEN_RSHIFT_ASSIGN:
+        valid = is_integer_type(left.type) && is_integer_type(right.type);
+        break;
+    default:
+        break;
+    }
+    if(!valid)
+    {
+        error_at(s->pos, "Invalid operands %s and %s for %s", type_str(left.type), type_str(right.type), token_type_name(op));
+    }
+}
+
+static void check_stmt(stmt* s)
+{
+    if(!s)
+    {
+        return;
+    }
+    switch(s->type)
+    {
+    case STMT_DECL:
+        if(s->decl->sym)
+        {
+            sym_type(s->decl->sym);
+        }
+        break;
+    case STMT_RETURN:
+        check_return(s);
+        break;
+    case STMT_BLOCK:
+        check_block(s->block);
+        break;
+    case STMT_IF:
+        check_cond(expr_at(s->if_stmt.cond));
+        check_block(s->if_stmt.then_block);
+        for(size_t i = 0; i < s->if_stmt.num_elseifs; i++)
+        {
+            check_cond(expr_at(s->if_stmt.elseifs[i].cond));
+            check_block(s->if_stmt.elseifs[i].block);
+        }
+        check_block(s->if_stmt.else_block);
+        break;
+    case STMT_FOR:
+        check_stmt(stmt_at(s->for_stmt.init));
+        check_cond(expr_at(s->for_stmt.cond));
+        check_stmt(stmt_at(s->for_stmt.next));
+        check_block(s->for_stmt.block);
+        break;
+    case STMT_WHILE:
+        check_cond(expr_at(s->while_stmt.cond));
+        check_block(s->while_stmt.block);
+        break;
+    case STMT_SWITCH:
+    {
+        expr* e = expr_at(s->switch_stmt.expr);
+        operand value = check_expr(e, NULL);
+        check_value(e->pos, &value);
+        if(value.type != type_none && !is_scalar_type(value.type))
+        {
+            error_at(e->pos, "Cannot switch on a value of type %s", type_str(value.type));
+            value.type = type_none;
+        }
+        for(size_t i = 0; i < s->switch_stmt.num_cases; i++)
+        {
+            switch_case* c = &s->switch_stmt.cases[i];
+            for(size_t j = 0; j < c->num_exprs; j++)
+            {
+                expr* label = expr_at(c->exprs[j]);
+                operand op = check_expr(label, value.type);
+                check_value(label->pos, &op);
+                check_assignable(label->pos, &op, value.type);
+            }
+            check_block(c->block);
+        }
+        break;
+    }
+    case STMT_INIT:
+    {
+        sym* local = s->init.sym;
+        local->state = SYM_CHECKING;
+        local->type = check_var(NULL, NULL, expr_at(s->init.expr));
+        local->state = SYM_CHECKED;
+        break;
+    }
+    case STMT_ASSIGN:
+        check_assign(s);
+        break;
+    case STMT_EXPR:
+    {
+        expr* e = expr_at(s->expr);
+        operand op = check_expr(e, NULL);
+        check_value(e->pos, &op);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void check_decl(decl* d)
+{
+    switch(d->type)
+    {
+    case DECL_ENUM:
+    case DECL_ERR:
+        type_complete(d->sym->type);
+        for(size_t i = 0; i < d->enum_decl.num_items; i++)
+        {
+            expr* init = d->enum_decl.items[i].init;
+            if(init)
+            {
+                operand op = check_expr(init, NULL);
+                check_value(init->pos, &op);
+                if(op.type != type_none && !is_integer_type(op.type))
+                {
+                    error_at(init->pos, "Enum value must be an integer, got %s", type_str(op.type));
+                }
+            }
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+    {
+        Type* t = d->sym->type;
+        type_complete(t);
+        for(size_t i = 0; i < d->aggregate_decl.num_items; i++)
+        {
+            expr* init = d->aggregate_decl.items[i].init;
+            if(init)
+            {
+                Type* field = t->aggregate.fields[i].type;
+                operand op = check_expr(init, field);
+                check_value(init->pos, &op);
+                check_assignable(init->pos, &op, field);
+            }
+        }
+        break;
+    }
+    case DECL_VAR:
+    case DECL_CONST:
+        sym_type(d->sym);
+        break;
+    case DECL_FUNC:
+        sym_type(d->sym);
+        checker.func = d;
+        check_block(*func_decl_body(d));
+        checker.func = NULL;
+        break;
+    default:
+        break;
+    }
+}
+
+// Frees the types of the last package checked.
+void check_reset()
+{
+    arena_reset(&checker.arena);
+    checker.types = (type_table){0};
+    checker.typespec_types = (type_map){0};
+    checker.fields = (type_map){0};
+    buf_clear(checker.operands);
+    buf_clear(checker.frames);
+    checker.depth = 0;
+    checker.func = NULL;
+}
+
+// Type checks a package resolve_package has just resolved. Errors are
+// reported through error_at.
+void check_package(decl** decls, size_t num_decls)
+{
+    check_reset();
+    for(type_kind kind = TYPE_BOOL; kind <= TYPE_F64; kind++)
+    {
+        sym* s = resolve_global(str_intern(type_kind_names[kind]));
+        assert(s && s->kind == SYM_TYPE && !s->decl);
+        s->type = &builtin_types[kind];
+        s->state = SYM_CHECKED;
+    }
+    // Every declared type exists before anything refers to it.
+    for(size_t i = 0; i < num_decls; i++)
+    {
+        decl* d = decls[i];
+        sym* s = d->sym;
+        if(s && s->kind == SYM_TYPE)
+        {
+            type_kind kind = d->type == DECL_STRUCT ? TYPE_STRUCT : d->type == DECL_UNION ? TYPE_UNION : TYPE_ENUM;
+            s->type = type_aggregate(kind, d);
+            s->state = SYM_CHECKED;
+        }
+    }
+    for(size_t i = 0; i < num_decls; i++)
+    {
+        if(decls[i]->sym)
+        {
+            check_decl(decls[i]);
+        }
+    }
+}